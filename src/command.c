@@ -64,8 +64,8 @@ const struct command_s cmd_list[] = {
 	{"version", (cmd_handler)cmd_version, "Display firmware version info"},
 	{"help", (cmd_handler)cmd_help, "Display help for monitor commands"},
 	{"jtag_scan", (cmd_handler)cmd_jtag_scan, "Scan JTAG chain for devices" },
-	{"swdp_scan", (cmd_handler)cmd_swdp_scan, "Scan SW-DP for devices" },
-	{"frequency", (cmd_handler)cmd_frequency, "set minimum high and low times" },
+	{"swdp_scan", (cmd_handler)cmd_swdp_scan, "Scan SW-DP for devices: [TARGETID ...]" },
+	{"frequency", (cmd_handler)cmd_frequency, "set minimum high and low times: (<freq>|auto)" },
 	{"targets", (cmd_handler)cmd_targets, "Display list of available targets" },
 	{"morse", (cmd_handler)cmd_morse, "Display morse error message" },
 	{"halt_timeout", (cmd_handler)cmd_halt_timeout, "Timeout (ms) to wait until Cortex-M is halted: (Default 2000)" },
@@ -89,6 +89,7 @@ const struct command_s cmd_list[] = {
 };
 
 bool connect_assert_srst;
+bool clock_autotune;
 #if defined(PLATFORM_HAS_DEBUG) && (PC_HOSTED == 0)
 bool debug_bmp;
 #endif
@@ -234,6 +235,18 @@ bool cmd_swdp_scan(target *t, int argc, char **argv)
 #else
 		devs = adiv5_swdp_scan(targetid);
 #endif
+		/* Further TARGETIDs of multi-drop parts on the same bus */
+		for (int i = 2; (devs > 0) && (i < argc); i++) {
+			uint32_t more = strtol(argv[i], NULL, 0);
+			int found = adiv5_swdp_scan_more(more);
+			if (found < 0) {
+				gdb_outf("No multi-drop bus to add TARGETID %08" PRIx32
+				         " to\n", more);
+				break;
+			}
+			if (!found)
+				gdb_outf("No DP answers TARGETID %08" PRIx32 "\n", more);
+		}
 		}
 	switch (e.type) {
 	case EXCEPTION_TIMEOUT:
@@ -259,7 +272,9 @@ bool cmd_swdp_scan(target *t, int argc, char **argv)
 bool cmd_frequency(target *t, int argc, char **argv)
 {
 	(void)t;
-	if (argc == 2) {
+	if ((argc == 2) && !strcmp(argv[1], "auto")) {
+		clock_autotune = true;
+	} else if (argc == 2) {
 		char *p;
 		uint32_t frequency = strtol(argv[1], &p, 10);
 		switch(*p) {
@@ -270,13 +285,15 @@ bool cmd_frequency(target *t, int argc, char **argv)
 			frequency *= 1000*1000;
 			break;
 		}
+		clock_autotune = false;
 		platform_max_frequency_set(frequency);
 	}
 	uint32_t freq = platform_max_frequency_get();
 	if (freq == FREQ_FIXED)
 		gdb_outf("SWJ freq fixed\n");
 	else
-		gdb_outf("Max SWJ freq %08" PRIx32 "\n", freq);
+		gdb_outf("Max SWJ freq %08" PRIx32 "%s\n", freq,
+		         clock_autotune ? " (auto)" : "");
 	return true;
 
 }
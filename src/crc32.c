@@ -98,6 +98,17 @@ static uint32_t crc32_calc(uint32_t crc, uint8_t data)
 	return (crc << 8) ^ crc32_table[((crc >> 24) ^ data) & 255];
 }
 
+#if PC_HOSTED == 1
+uint32_t crc32_buf(const void *buf, size_t len)
+{
+	uint32_t crc = -1;
+	const uint8_t *data = buf;
+	while (len--)
+		crc = crc32_calc(crc, *data++);
+	return crc;
+}
+#endif
+
 int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 {
 	uint32_t crc = -1;
@@ -188,3 +199,33 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 }
 #endif
 
+/* Multiply two polynomials modulo the CRC-32 polynomial */
+static uint32_t crc32_mulmod(uint32_t a, uint32_t b)
+{
+	uint32_t res = 0;
+	for (int i = 31; i >= 0; i--) {
+		res = (res & 0x80000000) ? (res << 1) ^ 0x4C11DB7 : res << 1;
+		if (b & (1u << i))
+			res ^= a;
+	}
+	return res;
+}
+
+/* Return the CRC of the concatenation A|B from crc1 = CRC(A) and
+ * crc2 = CRC(B), with B len2 bytes long. Both CRCs as computed by
+ * generic_crc32(), i.e. started with all ones. This lets a target
+ * compute parts of a range with a hardware CRC unit.
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	/* x^(8 * len2) mod P by square and multiply */
+	uint32_t power = 0x100;
+	uint32_t shift = 1;
+	while (len2) {
+		if (len2 & 1)
+			shift = crc32_mulmod(shift, power);
+		power = crc32_mulmod(power, power);
+		len2 >>= 1;
+	}
+	return crc2 ^ crc32_mulmod(crc1 ^ 0xffffffff, shift);
+}
@@ -59,10 +59,88 @@ static char pbuf[BUF_SIZE + 1];
 static target *cur_target;
 static target *last_target;
 
+/* Threads selected by Hg and Hc, 0 for any/all. Threads are further
+ * cores of cur_target, see target_thread(). */
+static int gen_thread = 1;
+static int cont_thread;
+/* Thread that caused the last stop */
+static int stop_thread = 1;
+/* Threads resumed since the last stop, bit n for thread n */
+static uint32_t resumed_threads;
+
 static void handle_q_packet(char *packet, int len);
 static void handle_v_packet(char *packet, int len);
 static void handle_z_packet(char *packet, int len);
 
+static target *gdb_thread(int id)
+{
+	target *t = target_thread(cur_target, id ? id : stop_thread);
+	return t ? t : cur_target;
+}
+
+/* Resume threads of cur_target, an action of 's' steps a thread, 'c'
+ * continues it and 0 leaves it halted. */
+static void gdb_threads_resume(const char *actions)
+{
+	int n = target_thread_count(cur_target);
+	for (int i = 1; (i <= n) && (i < 32); i++) {
+		if (actions[i])
+			resumed_threads |= 1U << i;
+	}
+	target_threads_resume(cur_target, actions);
+}
+
+/* Wait for any resumed thread of cur_target to stop, then stop the
+ * others. Threads left halted are not polled, their halt reason is
+ * stale. With nothing resumed, report the last stop again. */
+static enum target_halt_reason gdb_threads_wait(target_addr *watch)
+{
+	enum target_halt_reason reason = TARGET_HALT_RUNNING;
+	int n = target_thread_count(cur_target);
+	uint32_t poll = resumed_threads ? resumed_threads : 1U << stop_thread;
+
+	while (1) {
+		for (int i = 1; (i <= n) && (i < 32) && !reason; i++) {
+			if (!(poll & (1U << i)))
+				continue;
+			reason = target_halt_poll(target_thread(cur_target, i), watch);
+			if (reason)
+				stop_thread = i;
+		}
+		if (reason)
+			break;
+		unsigned char c = gdb_if_getchar_to(0);
+		if((c == '\x03') || (c == '\x04')) {
+			/* Stop a resumed thread, the others follow below */
+			int i = 1;
+			while ((i < n) && (i < 31) && !(poll & (1U << i)))
+				i++;
+			target_halt_request(target_thread(cur_target, i));
+		}
+	}
+	/* All-stop mode: halt the other cores too */
+	for (int i = 1; (i <= n) && (i < 32); i++) {
+		if ((i == stop_thread) || !(poll & (1U << i)))
+			continue;
+		target *t = target_thread(cur_target, i);
+		target_addr thread_watch;
+		enum target_halt_reason r = target_halt_poll(t, &thread_watch);
+		if (r == TARGET_HALT_RUNNING) {
+			target_halt_request(t);
+			while (target_halt_poll(t, NULL) == TARGET_HALT_RUNNING);
+		} else if ((reason == TARGET_HALT_REQUEST) &&
+		           (r != TARGET_HALT_REQUEST)) {
+			/* Cores halted together by hardware: report the one
+			 * that hit something rather than one it stopped */
+			reason = r;
+			stop_thread = i;
+			*watch = thread_watch;
+		}
+	}
+	resumed_threads = 0;
+	return reason;
+}
+
 static void gdb_target_destroy_callback(struct target_controller *tc, target *t)
 {
 	(void)tc;
@@ -98,6 +176,32 @@ static struct target_controller gdb_controller = {
 	.system = hostio_system,
 };
 
+static void gdb_report_stop(enum target_halt_reason reason, target_addr watch)
+{
+	char thread[16] = "";
+	if (target_thread_count(cur_target) > 1)
+		snprintf(thread, sizeof(thread), "thread:%x;", stop_thread);
+
+	/* Translate reason to GDB signal */
+	switch (reason) {
+	case TARGET_HALT_ERROR:
+		gdb_putpacket_f("X%02X", GDB_SIGLOST);
+		morse("TARGET LOST.", true);
+		break;
+	case TARGET_HALT_REQUEST:
+		gdb_putpacket_f("T%02X%s", GDB_SIGINT, thread);
+		break;
+	case TARGET_HALT_WATCHPOINT:
+		gdb_putpacket_f("T%02X%swatch:%08X;", GDB_SIGTRAP, thread, watch);
+		break;
+	case TARGET_HALT_FAULT:
+		gdb_putpacket_f("T%02X%s", GDB_SIGSEGV, thread);
+		break;
+	default:
+		gdb_putpacket_f("T%02X%s", GDB_SIGTRAP, thread);
+	}
+}
+
 int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 {
 	int size;
@@ -112,8 +216,9 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 		/* Implementation of these is mandatory! */
 		case 'g': { /* 'g': Read general registers */
 			ERROR_IF_NO_TARGET();
-			uint8_t arm_regs[target_regs_size(cur_target)];
-			target_regs_read(cur_target, arm_regs);
+			target *t = gdb_thread(gen_thread);
+			uint8_t arm_regs[target_regs_size(t)];
+			target_regs_read(t, arm_regs);
 			gdb_putpacket(hexify(pbuf, arm_regs, sizeof(arm_regs)),
 			              sizeof(arm_regs) * 2);
 			break;
@@ -137,9 +242,10 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 		}
 		case 'G': {	/* 'G XX': Write general registers */
 			ERROR_IF_NO_TARGET();
-			uint8_t arm_regs[target_regs_size(cur_target)];
+			target *t = gdb_thread(gen_thread);
+			uint8_t arm_regs[target_regs_size(t)];
 			unhexify(arm_regs, &pbuf[1], sizeof(arm_regs));
-			target_regs_write(cur_target, arm_regs);
+			target_regs_write(t, arm_regs);
 			gdb_putpacketz("OK");
 			break;
 		}
@@ -171,7 +277,20 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 				break;
 			}
 
-			target_halt_resume(cur_target, single_step);
+			if (target_thread_count(cur_target) > 1) {
+				/* Step only the selected thread, continue
+				 * the selected one or all. */
+				char actions[target_thread_count(cur_target) + 1];
+				int id = cont_thread ? cont_thread : stop_thread;
+				for (size_t i = 0; i < sizeof(actions); i++)
+					actions[i] = single_step ? 0 :
+						(cont_thread && (int)i != id) ? 0 : 'c';
+				actions[id] = single_step ? 's' : 'c';
+				gdb_threads_resume(actions);
+			} else {
+				target_halt_resume(cur_target, single_step);
+				resumed_threads = 1U << 1;
+			}
 			SET_RUN_STATE(1);
 			single_step = false;
 			/* fall through */
@@ -188,32 +307,9 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			}
 
 			/* Wait for target halt */
-			while(!(reason = target_halt_poll(cur_target, &watch))) {
-				unsigned char c = gdb_if_getchar_to(0);
-				if((c == '\x03') || (c == '\x04')) {
-					target_halt_request(cur_target);
-				}
-			}
+			reason = gdb_threads_wait(&watch);
 			SET_RUN_STATE(0);
-
-			/* Translate reason to GDB signal */
-			switch (reason) {
-			case TARGET_HALT_ERROR:
-				gdb_putpacket_f("X%02X", GDB_SIGLOST);
-				morse("TARGET LOST.", true);
-				break;
-			case TARGET_HALT_REQUEST:
-				gdb_putpacket_f("T%02X", GDB_SIGINT);
-				break;
-			case TARGET_HALT_WATCHPOINT:
-				gdb_putpacket_f("T%02Xwatch:%08X;", GDB_SIGTRAP, watch);
-				break;
-			case TARGET_HALT_FAULT:
-				gdb_putpacket_f("T%02X", GDB_SIGSEGV);
-				break;
-			default:
-				gdb_putpacket_f("T%02X", GDB_SIGTRAP);
-			}
+			gdb_report_stop(reason, watch);
 			break;
 		}
 
@@ -223,7 +319,8 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			uint32_t reg;
 			sscanf(pbuf, "p%" SCNx32, &reg);
 			uint8_t val[8];
-			size_t s = target_reg_read(cur_target, reg, val, sizeof(val));
+			size_t s = target_reg_read(gdb_thread(gen_thread), reg, val,
+			                           sizeof(val));
 			if (s > 0)
 				gdb_putpacket(hexify(pbuf, val, s), s * 2);
 			else
@@ -238,13 +335,38 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			// TODO: FIXME, VLAs considered harmful.
 			uint8_t val[strlen(&pbuf[n]) / 2];
 			unhexify(val, pbuf + n, sizeof(val));
-			if (target_reg_write(cur_target, reg, val, sizeof(val)) > 0)
+			if (target_reg_write(gdb_thread(gen_thread), reg, val,
+			                     sizeof(val)) > 0)
 				gdb_putpacketz("OK");
 			else
 				gdb_putpacketz("EFF");
 			break;
 		}
 
+		case 'H': { /* 'Hg thread' or 'Hc thread': Set thread */
+			int id = strtol(&pbuf[2], NULL, 16);
+			if (id < 0)
+				id = 0;
+			if (id && (!cur_target || !target_thread(cur_target, id))) {
+				gdb_putpacketz("E01");
+				break;
+			}
+			if (pbuf[1] == 'g')
+				gen_thread = id;
+			else
+				cont_thread = id;
+			gdb_putpacketz("OK");
+			break;
+		}
+		case 'T': { /* 'T thread': Is thread alive */
+			int id = strtol(&pbuf[1], NULL, 16);
+			if (cur_target && target_thread(cur_target, id))
+				gdb_putpacketz("OK");
+			else
+				gdb_putpacketz("E01");
+			break;
+		}
+
 		case 'F':	/* Semihosting call finished */
 			if (in_syscall)
 				return hostio_reply(tc, pbuf, size);
@@ -445,7 +567,9 @@ static void exec_q_crc(const char *packet, int len)
 			return;
 		}
 		uint32_t crc;
-		int res = generic_crc32(cur_target, &crc, addr, alen);
+		int res = target_crc32(cur_target, &crc, addr, alen);
+		if (res > 0)
+			res = generic_crc32(cur_target, &crc, addr, alen);
 		if (res)
 			gdb_putpacketz("E03");
 		else
@@ -453,6 +577,52 @@ static void exec_q_crc(const char *packet, int len)
 	}
 }
 
+static void exec_q_first_thread_info(const char *packet, int len)
+{
+	(void)packet;
+	(void)len;
+	if (!cur_target) {
+		gdb_putpacketz("l");
+		return;
+	}
+	/* All threads fit in the first reply */
+	char buf[64] = "m1";
+	int n = target_thread_count(cur_target);
+	for (int i = 2; i <= n; i++) {
+		size_t used = strlen(buf);
+		snprintf(buf + used, sizeof(buf) - used, ",%x", i);
+	}
+	gdb_putpacketz(buf);
+}
+
+static void exec_q_subsequent_thread_info(const char *packet, int len)
+{
+	(void)packet;
+	(void)len;
+	gdb_putpacketz("l");
+}
+
+static void exec_q_current_thread(const char *packet, int len)
+{
+	(void)packet;
+	(void)len;
+	gdb_putpacket_f("QC%x", stop_thread);
+}
+
+static void exec_q_thread_extra_info(const char *packet, int len)
+{
+	(void)len;
+	int id = strtol(packet, NULL, 16);
+	target *t = cur_target ? target_thread(cur_target, id) : NULL;
+	if (!t) {
+		gdb_putpacketz("E01");
+		return;
+	}
+	char info[32];
+	snprintf(info, sizeof(info), "Core %d", id - 1);
+	gdb_putpacket(hexify(pbuf, info, strlen(info)), 2 * strlen(info));
+}
+
 static const cmd_executer q_commands[]=
 {
 	{"qRcmd,",                         exec_q_rcmd},
@@ -460,6 +630,10 @@ static const cmd_executer q_commands[]=
 	{"qXfer:memory-map:read::",        exec_q_memory_map},
 	{"qXfer:features:read:target.xml:",exec_q_feature_read},
 	{"qCRC:",                          exec_q_crc},
+	{"qfThreadInfo",                   exec_q_first_thread_info},
+	{"qsThreadInfo",                   exec_q_subsequent_thread_info},
+	{"qThreadExtraInfo,",              exec_q_thread_extra_info},
+	{"qC",                             exec_q_current_thread},
 	{NULL, NULL},
 };
 
@@ -482,6 +656,10 @@ handle_v_packet(char *packet, int plen)
 	if (sscanf(packet, "vAttach;%08lx", &addr) == 1) {
 		/* Attach to remote target processor */
 		cur_target = target_attach_n(addr, &gdb_controller);
+		gen_thread = 1;
+		cont_thread = 0;
+		stop_thread = 1;
+		resumed_threads = 0;
 		if(cur_target) {
 			morse(NULL, false);
 			gdb_putpacketz("T05");
@@ -571,6 +749,43 @@ handle_v_packet(char *packet, int plen)
 			gdb_putpacketz("EFF");
 		}
 
+	} else if (!strcmp(packet, "vCont?")) {
+		/* Only worth it with threads, GDB then uses plain c and s */
+		if (cur_target && (target_thread_count(cur_target) > 1))
+			gdb_putpacketz("vCont;c;C;s;S");
+		else
+			gdb_putpacketz("");
+
+	} else if (!strncmp(packet, "vCont;", 6)) {
+		/* Resume threads, the leftmost action matching a thread
+		 * applies to it. */
+		if (!cur_target) {
+			gdb_putpacketz("X1D");
+			return;
+		}
+		int n = target_thread_count(cur_target);
+		char actions[n + 1];
+		memset(actions, 0, sizeof(actions));
+		for (char *p = packet + 5; p && *p == ';'; p = strchr(p + 1, ';')) {
+			char action = tolower((unsigned char)p[1]);
+			if (action != 'c' && action != 's')
+				continue;
+			char *tid = strchr(p + 1, ':');
+			char *next = strchr(p + 1, ';');
+			int id = (tid && (!next || tid < next)) ?
+				strtol(tid + 1, NULL, 16) : -1;
+			for (int i = 1; i <= n; i++)
+				if (!actions[i] && (id <= 0 || id == i))
+					actions[i] = action;
+		}
+		gdb_threads_resume(actions);
+		SET_RUN_STATE(1);
+
+		target_addr watch;
+		enum target_halt_reason reason = gdb_threads_wait(&watch);
+		SET_RUN_STATE(0);
+		gdb_report_stop(reason, watch);
+
 	} else if (!strcmp(packet, "vFlashDone")) {
 		/* Commit flash operations. */
 		gdb_putpacketz(target_flash_done(cur_target) ? "EFF" : "OK");
@@ -598,6 +813,15 @@ handle_z_packet(char *packet, int plen)
 	else
 		ret = target_breakwatch_clear(cur_target, type, addr, len);
 
+	/* Further cores have their own break-/watchpoint units */
+	for (int i = 2; i <= target_thread_count(cur_target); i++) {
+		target *t = target_thread(cur_target, i);
+		if (set)
+			target_breakwatch_set(t, type, addr, len);
+		else
+			target_breakwatch_clear(t, type, addr, len);
+	}
+
 	if (ret < 0)
 		gdb_putpacketz("E01");
 	else if (ret > 0)
@@ -22,5 +22,9 @@
 #define __CRC32_H
 
 int generic_crc32(target *t, uint32_t *crc, uint32_t base, int len);
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+#if PC_HOSTED == 1
+uint32_t crc32_buf(const void *buf, size_t len);
+#endif
 
 #endif
@@ -39,6 +39,7 @@ void platform_delay(uint32_t ms);
 
 #define POWER_CONFLICT_THRESHOLD	5 /* in 0.1V, so 5 stands for 0.5V */
 extern bool connect_assert_srst;
+extern bool clock_autotune;
 uint32_t platform_target_voltage_sense(void);
 const char *platform_target_voltage(void);
 int platform_hwversion(void);
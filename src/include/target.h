@@ -39,6 +39,7 @@ int platform_adiv5_swdp_scan(uint32_t targetid);
 int platform_jtag_scan(const uint8_t *lrlens);
 #endif
 int adiv5_swdp_scan(uint32_t targetid);
+int adiv5_swdp_scan_more(uint32_t targetid);
 int jtag_scan(const uint8_t *lrlens);
 
 int target_foreach(void (*cb)(int i, target *t, void *context), void *context);
@@ -49,6 +50,8 @@ target *target_attach(target *t, struct target_controller *);
 target *target_attach_n(int n, struct target_controller *);
 void target_detach(target *t);
 bool target_attached(target *t);
+int target_thread_count(target *t);
+target *target_thread(target *t, int n);
 const char *target_driver_name(target *t);
 const char *target_core_name(target *t);
 unsigned int target_designer(target *t);
@@ -58,6 +61,7 @@ unsigned int target_idcode(target *t);
 bool target_mem_map(target *t, char *buf, size_t len);
 int target_mem_read(target *t, void *dest, target_addr src, size_t len);
 int target_mem_write(target *t, target_addr dest, const void *src, size_t len);
+int target_crc32(target *t, uint32_t *crc, target_addr base, size_t len);
 /* Flash memory access functions */
 int target_flash_erase(target *t, target_addr addr, size_t len);
 int target_flash_write(target *t, target_addr dest, const void *src, size_t len);
@@ -86,6 +90,7 @@ void target_reset(target *t);
 void target_halt_request(target *t);
 enum target_halt_reason target_halt_poll(target *t, target_addr *watch);
 void target_halt_resume(target *t, bool step);
+void target_threads_resume(target *t, const char *actions);
 void target_set_cmdline(target *t, char *cmdline);
 void target_set_heapinfo(target *t, target_addr heap_base, target_addr heap_limit,
 	target_addr stack_base, target_addr stack_limit);
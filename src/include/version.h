@@ -0,0 +1 @@
+#define FIRMWARE_VERSION "ecd84ed-dirty"
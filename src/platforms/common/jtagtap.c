@@ -113,87 +113,86 @@ static void jtagtap_tms_seq(uint32_t MS, int ticks)
 	}
 }
 
-static void jtagtap_tdi_tdo_seq(
-	uint8_t *DO, const uint8_t final_tms, const uint8_t *DI, int ticks)
+/* Clock bits of data out on TDI, LSB first, leaving TMS as it is.
+ * Returns the bits sampled on TDO. */
+static uint8_t jtagtap_shift_bits(uint8_t data, int bits)
 {
-	uint8_t index = 1;
-	gpio_set_val(TMS_PORT, TMS_PIN, 0);
 	uint8_t res = 0;
 	register volatile int32_t cnt;
 	if (swd_delay_cnt) {
-		while(ticks > 1) {
-			gpio_set_val(TDI_PORT, TDI_PIN, *DI & index);
+		for (int i = 0; i < bits; i++) {
+			gpio_set_val(TDI_PORT, TDI_PIN, data & 1);
+			data >>= 1;
 			gpio_set(TCK_PORT, TCK_PIN);
 			for(cnt = swd_delay_cnt -2 ; cnt > 0; cnt--);
-			if (gpio_get(TDO_PORT, TDO_PIN)) {
-				res |= index;
-			}
-			if(!(index <<= 1)) {
-				*DO = res;
-				res = 0;
-				index = 1;
-				DI++; DO++;
-			}
-			ticks--;
+			if (gpio_get(TDO_PORT, TDO_PIN))
+				res |= 1 << i;
 			gpio_clear(TCK_PORT, TCK_PIN);
 			for(cnt = swd_delay_cnt -2 ; cnt > 0; cnt--);
 		}
 	} else {
-		while(ticks > 1) {
-			gpio_set_val(TDI_PORT, TDI_PIN, *DI & index);
+		for (int i = 0; i < bits; i++) {
+			gpio_set_val(TDI_PORT, TDI_PIN, data & 1);
+			data >>= 1;
 			gpio_set(TCK_PORT, TCK_PIN);
-			if (gpio_get(TDO_PORT, TDO_PIN)) {
-				res |= index;
-			}
-			if(!(index <<= 1)) {
-				*DO = res;
-				res = 0;
-				index = 1;
-				DI++; DO++;
-			}
-			ticks--;
+			if (gpio_get(TDO_PORT, TDO_PIN))
+				res |= 1 << i;
 			gpio_clear(TCK_PORT, TCK_PIN);
 		}
 	}
-	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
-	gpio_set_val(TDI_PORT, TDI_PIN, *DI & index);
-	gpio_set(TCK_PORT, TCK_PIN);
-			for(cnt = swd_delay_cnt -2 ; cnt > 0; cnt--);
-	if (gpio_get(TDO_PORT, TDO_PIN)) {
-		res |= index;
-	}
-	*DO = res;
-	gpio_clear(TCK_PORT, TCK_PIN);
-	for(cnt = swd_delay_cnt -2 ; cnt > 0; cnt--);
+	return res;
 }
 
-static void jtagtap_tdi_seq(const uint8_t final_tms, const uint8_t *DI, int ticks)
+/* As above, without sampling TDO */
+static void jtagtap_out_bits(uint8_t data, int bits)
 {
-	uint8_t index = 1;
 	register volatile int32_t cnt;
 	if (swd_delay_cnt) {
-		while(ticks--) {
-			gpio_set_val(TMS_PORT, TMS_PIN, ticks? 0 : final_tms);
-			gpio_set_val(TDI_PORT, TDI_PIN, *DI & index);
+		for (int i = 0; i < bits; i++) {
+			gpio_set_val(TDI_PORT, TDI_PIN, data & 1);
+			data >>= 1;
 			gpio_set(TCK_PORT, TCK_PIN);
 			for(cnt = swd_delay_cnt -2 ; cnt > 0; cnt--);
-			if(!(index <<= 1)) {
-				index = 1;
-				DI++;
-			}
 			gpio_clear(TCK_PORT, TCK_PIN);
 			for(cnt = swd_delay_cnt -2 ; cnt > 0; cnt--);
 		}
 	} else {
-		while(ticks--) {
-			gpio_set_val(TMS_PORT, TMS_PIN, ticks? 0 : final_tms);
-			gpio_set_val(TDI_PORT, TDI_PIN, *DI & index);
+		for (int i = 0; i < bits; i++) {
+			gpio_set_val(TDI_PORT, TDI_PIN, data & 1);
+			data >>= 1;
 			gpio_set(TCK_PORT, TCK_PIN);
-			if(!(index <<= 1)) {
-				index = 1;
-				DI++;
-			}
 			gpio_clear(TCK_PORT, TCK_PIN);
 		}
 	}
 }
+
+/* All bits but the last go out a byte at a time with TMS low.  Only
+ * the last bit carries final_tms. */
+static void jtagtap_tdi_tdo_seq(
+	uint8_t *DO, const uint8_t final_tms, const uint8_t *DI, int ticks)
+{
+	if (ticks <= 0)
+		return;
+	gpio_set_val(TMS_PORT, TMS_PIN, 0);
+	for (int n = (ticks - 1) / 8; n > 0; n--)
+		*DO++ = jtagtap_shift_bits(*DI++, 8);
+	int rest = (ticks - 1) % 8;
+	uint8_t data = *DI;
+	uint8_t res = jtagtap_shift_bits(data, rest);
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	res |= jtagtap_shift_bits(data >> rest, 1) << rest;
+	*DO = res;
+}
+
+static void jtagtap_tdi_seq(const uint8_t final_tms, const uint8_t *DI, int ticks)
+{
+	if (ticks <= 0)
+		return;
+	gpio_set_val(TMS_PORT, TMS_PIN, 0);
+	for (int n = (ticks - 1) / 8; n > 0; n--)
+		jtagtap_out_bits(*DI++, 8);
+	int rest = (ticks - 1) % 8;
+	jtagtap_out_bits(*DI, rest);
+	gpio_set_val(TMS_PORT, TMS_PIN, final_tms);
+	jtagtap_out_bits(*DI >> rest, 1);
+}
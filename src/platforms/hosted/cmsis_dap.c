@@ -268,22 +268,18 @@ int dbg_dap_cmd(uint8_t *data, int size, int rsize)
 #define ALIGNOF(x) (((x) & 3) == 0 ? ALIGN_WORD :					\
                     (((x) & 1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
-static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+/* Packed transfers carry a word of byte/halfword accesses per DRW */
+static void dap_mem_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
+							   size_t len, enum align align, bool packed)
 {
-	if (len == 0)
-		return;
-	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
-	DEBUG_WIRE("memread @ %" PRIx32 " len %ld, align %d , start: \n",
-		   src, len, align);
-	if (((unsigned)(1 << align)) == len)
-		return dap_read_single(ap, dest, src, align);
+	enum align lane = packed ? ALIGN_WORD : align;
 	/* One word transfer for every byte/halfword/word
 	 * Total number of bytes in transfer*/
-	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - align)) & ~3;
+	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - lane)) & ~3;
 	while (len) {
-		dap_ap_mem_access_setup(ap, src, align);
+		dap_ap_mem_access_setup(ap, src, align, packed);
 		/* Calculate length until next access setup is needed */
-		unsigned int blocksize = (src | 0x3ff) - src + 1;
+		unsigned int blocksize = (src | adiv5_ap_tar_mask(ap)) - src + 1;
 		if (blocksize > len)
 			blocksize = len;
 		while (blocksize) {
@@ -291,7 +287,7 @@ static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 			if (transfersize > max_size)
 				transfersize = max_size;
 			unsigned int res = dap_read_block(ap, dest, src, transfersize,
-											  align);
+											  lane);
 			if (res) {
 			    DEBUG_WIRE("mem_read failed %02x\n", res);
 				ap->dp->fault = 1;
@@ -303,23 +299,38 @@ static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 			src       += transfersize;
 		}
 	}
-    DEBUG_WIRE("memread res last data %08" PRIx32 "\n", ((uint32_t*)dest)[-1]);
 }
 
-static void dap_mem_write_sized(
-	ADIv5_AP_t *ap, uint32_t dest, const void *src,
-							size_t len, enum align align)
+static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
 	if (len == 0)
 		return;
-	DEBUG_WIRE("memwrite @ %" PRIx32 " len %ld, align %d , %08x start: \n",
-		dest, len, align, *(uint32_t *)src);
+	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	DEBUG_WIRE("memread @ %" PRIx32 " len %ld, align %d , start: \n",
+		   src, len, align);
 	if (((unsigned)(1 << align)) == len)
-		return dap_write_single(ap, dest, src, align);
-	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - align) & ~3);
+		return dap_read_single(ap, dest, src, align);
+	size_t head = 0;
+	size_t body = adiv5_mem_packed_split(ap, src, len, align, &head);
+	if (body) {
+		dap_mem_read(ap, dest, src, head);
+		dap_mem_read_block(ap, dest + head, src + head, body, align, true);
+		dap_mem_read(ap, dest + head + body, src + head + body,
+					 len - head - body);
+	} else {
+		dap_mem_read_block(ap, dest, src, len, align, false);
+	}
+	DEBUG_WIRE("memread done\n");
+}
+
+static void dap_mem_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+								size_t len, enum align align, bool packed)
+{
+	enum align lane = packed ? ALIGN_WORD : align;
+	unsigned int max_size = ((dbg_get_report_size() - 6) >> (2 - lane) & ~3);
 	while (len) {
-		dap_ap_mem_access_setup(ap, dest, align);
-		unsigned int blocksize = (dest | 0x3ff) - dest + 1;
+		dap_ap_mem_access_setup(ap, dest, align, packed);
+		unsigned int blocksize = (dest | adiv5_ap_tar_mask(ap)) - dest + 1;
 		if (blocksize > len)
 			blocksize = len;
 		while (blocksize) {
@@ -327,7 +338,7 @@ static void dap_mem_write_sized(
 			if (transfersize > max_size)
 				transfersize = max_size;
 			unsigned int res = dap_write_block(ap, dest, src, transfersize,
-											   align);
+											   lane);
 			if (res) {
 				DEBUG_WARN("mem_write failed %02x\n", res);
 				ap->dp->fault = 1;
@@ -339,6 +350,28 @@ static void dap_mem_write_sized(
 			src       += transfersize;
 		}
 	}
+}
+
+static void dap_mem_write_sized(
+	ADIv5_AP_t *ap, uint32_t dest, const void *src,
+							size_t len, enum align align)
+{
+	if (len == 0)
+		return;
+	DEBUG_WIRE("memwrite @ %" PRIx32 " len %ld, align %d , %08x start: \n",
+		dest, len, align, *(uint32_t *)src);
+	if (((unsigned)(1 << align)) == len)
+		return dap_write_single(ap, dest, src, align);
+	size_t head = 0;
+	size_t body = adiv5_mem_packed_split(ap, dest, len, align, &head);
+	if (body) {
+		dap_mem_write_sized(ap, dest, src, head, align);
+		dap_mem_write_block(ap, dest + head, src + head, body, align, true);
+		dap_mem_write_sized(ap, dest + head + body, src + head + body,
+							len - head - body, align);
+	} else {
+		dap_mem_write_block(ap, dest, src, len, align, false);
+	}
 	DEBUG_WIRE("memwrite done\n");
 }
 
@@ -405,12 +438,20 @@ int cmsis_dap_jtagtap_init(jtag_proc_t *jtag_proc)
 	return 0;
 }
 
+/* Return all TAPs to Run-Test/Idle */
+static void dap_jtagdp_resync(ADIv5_DP_t *dp)
+{
+	(void)dp;
+	cmsis_dap_jtagtap_reset();
+}
+
 int dap_jtag_dp_init(ADIv5_DP_t *dp)
 {
 	dp->dp_read = dap_dp_read_reg;
 	dp->error = dap_dp_error;
 	dp->low_access = dap_dp_low_access;
 	dp->abort = dap_dp_abort;
+	dp->resync = dap_jtagdp_resync;
 
 	return true;
 }
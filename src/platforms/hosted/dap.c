@@ -443,7 +443,7 @@ unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 	if (align > ALIGN_HALFWORD) {
 		memcpy(&buf[5], src, len);
 	} else {
-		unsigned int size = len;
+		unsigned int size = sz;
 		uint32_t *p = (uint32_t *)&buf[5];
 		while (size) {
 			uint32_t tmp = 0;
@@ -518,9 +518,10 @@ uint32_t dap_read_idcode(ADIv5_DP_t *dp)
 }
 
 static uint8_t *mem_access_setup(ADIv5_AP_t *ap, uint8_t *p,
-								 uint32_t addr, enum align align)
+								 uint32_t addr, enum align align, bool packed)
 {
-	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	uint32_t csw = ap->csw | (packed ? ADIV5_AP_CSW_ADDRINC_PACKED :
+	                                   ADIV5_AP_CSW_ADDRINC_SINGLE);
 	switch (align) {
 	case ALIGN_BYTE:
 		csw |= ADIV5_AP_CSW_SIZE_BYTE;
@@ -556,10 +557,11 @@ static uint8_t *mem_access_setup(ADIv5_AP_t *ap, uint8_t *p,
 	return p;
 }
 
-void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
+void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align,
+                             bool packed)
 {
 	uint8_t buf[63];
-	uint8_t *p = mem_access_setup(ap, buf, addr, align);
+	uint8_t *p = mem_access_setup(ap, buf, addr, align, packed);
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
 }
 
@@ -615,7 +617,7 @@ void dap_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 void dap_read_single(ADIv5_AP_t *ap, void *dest, uint32_t src, enum align align)
 {
 	uint8_t buf[63];
-	uint8_t *p = mem_access_setup(ap, buf, src, align);
+	uint8_t *p = mem_access_setup(ap, buf, src, align, false);
 	*p++ = SWD_AP_DRW | DAP_TRANSFER_RnW;
 	*p++ = SWD_DP_R_RDBUFF | DAP_TRANSFER_RnW;
 	buf[2] = 5;
@@ -627,7 +629,7 @@ void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 					  enum align align)
 {
 	uint8_t buf[63];
-	uint8_t *p = mem_access_setup(ap, buf, dest, align);
+	uint8_t *p = mem_access_setup(ap, buf, dest, align, false);
 	*p++ = SWD_AP_DRW;
 	uint32_t tmp = 0;
 	/* Pack data into correct data lane */
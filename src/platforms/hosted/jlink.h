@@ -50,7 +50,7 @@
 # pragma GCC diagnostic push
 # pragma GCC diagnostic ignored "-Wunused-parameter"
 int jlink_init(bmp_info_t *info) {return -1;};
-int jlink_swdp_scan(bmp_info_t *info) {return 0;};
+int jlink_swdp_scan(bmp_info_t *info, bool batch) {return 0;};
 int jlink_jtagtap_init(bmp_info_t *info, jtag_proc_t *jtag_proc) {return 0;};
 const char *jlink_target_voltage(bmp_info_t *info) {return "ERROR";};
 void jlink_srst_set_val(bmp_info_t *info, bool assert) {};
@@ -97,7 +97,7 @@ enum jaylink_device_capability {
 
 
 int jlink_init(bmp_info_t *info);
-int jlink_swdp_scan(bmp_info_t *info);
+int jlink_swdp_scan(bmp_info_t *info, bool batch);
 int jlink_jtagtap_init(bmp_info_t *info, jtag_proc_t *jtag_proc);
 const char *jlink_target_voltage(bmp_info_t *info);
 void jlink_srst_set_val(bmp_info_t *info, bool assert);
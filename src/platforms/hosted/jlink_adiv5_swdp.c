@@ -45,6 +45,15 @@ static uint32_t jlink_adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 
 static void jlink_adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 
+static void jlink_adiv5_swdp_resync(ADIv5_DP_t *dp);
+
+static void jlink_adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src,
+                                 size_t len);
+
+static void jlink_adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest,
+                                        const void *src, size_t len,
+                                        enum align align);
+
 enum {
 	SWDIO_WRITE = 0,
 	SWDIO_READ
@@ -117,7 +126,7 @@ static int jlink_swdptap_init(bmp_info_t *info)
 	return 0;
 }
 
-int jlink_swdp_scan(bmp_info_t *info)
+int jlink_swdp_scan(bmp_info_t *info, bool batch)
 {
 	jlink_swdptap_init(info);
 	target_list_free();
@@ -188,12 +197,26 @@ int jlink_swdp_scan(bmp_info_t *info)
 	dp->error = jlink_adiv5_swdp_error;
 	dp->low_access = jlink_adiv5_swdp_low_access;
 	dp->abort = jlink_adiv5_swdp_abort;
+	dp->resync = jlink_adiv5_swdp_resync;
+	/* Batched transfers are not yet verified on hardware, so they
+	 * are only used on request (-B) */
+	if (batch) {
+		dp->mem_read = jlink_adiv5_mem_read;
+		dp->mem_write_sized = jlink_adiv5_mem_write_sized;
+	}
 
 	jlink_adiv5_swdp_error(dp);
 	adiv5_dp_init(dp);
 	return target_list?1:0;
 }
 
+/* The line reset ends with a DP_IDR read, which selects the DP again */
+static void jlink_adiv5_swdp_resync(ADIv5_DP_t *dp)
+{
+	(void)dp;
+	line_reset(&info);
+}
+
 static uint32_t jlink_adiv5_swdp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
 	if (addr & ADIV5_APnDP) {
@@ -325,3 +348,256 @@ static void jlink_adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
 }
+
+/* Batched SWD transactions
+ *
+ * Complete transactions are clocked out back to back in one
+ * CMD_HW_JTAG3, each laid out as the two phases of
+ * jlink_adiv5_swdp_low_access() would send them.  Overrun detection is
+ * on while a batch runs, so a WAIT or FAULT still has its data phase
+ * and the stream stays in step.  Only the first failing transaction
+ * and the ones after it need to be redone one by one.
+ */
+#define JLINK_SWD_READ_BITS  (11 + 35)
+#define JLINK_SWD_WRITE_BITS (13 + 41)
+/* Size of the direction and data buffers of one CMD_HW_JTAG3 */
+#define JLINK_SWD_BATCH_BYTES 2048
+/* Memory elements per TAR load */
+#define JLINK_MEM_CHUNK 256
+
+struct jlink_swd_xfer {
+	uint8_t RnW;
+	uint16_t addr;
+	uint32_t value; /* Data to write, or data read */
+	uint8_t ack;    /* 0 on parity error */
+};
+
+static void swd_bits_set(uint8_t *buf, int pos, uint32_t val, int bits)
+{
+	for (int i = 0; i < bits; i++, pos++)
+		if (val & (1u << i))
+			buf[pos / 8] |= 1 << (pos % 8);
+}
+
+static uint32_t swd_bits_get(const uint8_t *buf, int pos, int bits)
+{
+	uint32_t val = 0;
+	for (int i = 0; i < bits; i++, pos++)
+		if (buf[pos / 8] & (1 << (pos % 8)))
+			val |= 1u << i;
+	return val;
+}
+
+/* Run as many transactions as fit into one command.  Returns the
+ * number of transactions done, counting from the start, that were
+ * ACKed OK.  Sets *failed if another transaction was not. */
+static int jlink_swd_batch(struct jlink_swd_xfer *xfer, int count,
+                           bool *failed)
+{
+	int bits = 0;
+	int n = 0;
+	for (; n < count; n++) {
+		int next = (xfer[n].RnW) ? JLINK_SWD_READ_BITS : JLINK_SWD_WRITE_BITS;
+		if (bits + next > JLINK_SWD_BATCH_BYTES * 8)
+			break;
+		bits += next;
+	}
+	int len = (bits + 7) / 8;
+	uint8_t *cmd = alloca(4 + 2 * len);
+	memset(cmd, 0, 4 + 2 * len);
+	cmd[0] = CMD_HW_JTAG3;
+	cmd[1] = 0;
+	cmd[2] = bits & 0xff;
+	cmd[3] = bits >> 8;
+	uint8_t *direction = cmd + 4;
+	uint8_t *data = direction + len;
+	int pos = 0;
+	for (int i = 0; i < n; i++) {
+		swd_bits_set(direction, pos, 0xff, 8);
+		swd_bits_set(data, pos, make_packet_request(xfer[i].RnW,
+		                                            xfer[i].addr), 8);
+		if (xfer[i].RnW) {
+			/* Turnaround and ACK in, then data and parity in,
+			 * turnaround and idle out */
+			pos += 11;
+			swd_bits_set(direction, pos + 33, 3, 2);
+			pos += 35;
+		} else {
+			/* Turnaround, ACK in and turnaround, then data,
+			 * parity and 8 idle cycles out */
+			swd_bits_set(direction, pos + 12, 1, 1);
+			pos += 13;
+			swd_bits_set(direction, pos, 0xffffffff, 32);
+			swd_bits_set(direction, pos + 32, 0x1ff, 9);
+			swd_bits_set(data, pos, xfer[i].value, 32);
+			swd_bits_set(data, pos + 32,
+			             __builtin_popcount(xfer[i].value) & 1, 1);
+			pos += 41;
+		}
+	}
+	uint8_t *res = alloca(len);
+	uint8_t status[1];
+	send_recv(info.usb_link, cmd, 4 + 2 * len, res, len);
+	send_recv(info.usb_link, NULL, 0, status, 1);
+	if (status[0] != 0)
+		raise_exception(EXCEPTION_ERROR, "SWD batch failed");
+
+	*failed = false;
+	pos = 0;
+	for (int i = 0; i < n; i++) {
+		xfer[i].ack = swd_bits_get(res, pos + 8, 3);
+		if (xfer[i].ack != SWDP_ACK_OK) {
+			*failed = true;
+			return i;
+		}
+		if (xfer[i].RnW) {
+			xfer[i].value = swd_bits_get(res, pos + 11, 32);
+			int parity = swd_bits_get(res, pos + 43, 1);
+			if ((__builtin_popcount(xfer[i].value) + parity) & 1) {
+				xfer[i].ack = 0;
+				*failed = true;
+				return i;
+			}
+			pos += JLINK_SWD_READ_BITS;
+		} else {
+			pos += JLINK_SWD_WRITE_BITS;
+		}
+	}
+	return n;
+}
+
+/* Run count transactions, framed by CTRL/STAT writes switching overrun
+ * detection on and off.  From the first WAIT or FAULT on, the rest go
+ * through jlink_adiv5_swdp_low_access() with its usual retries. */
+static void jlink_swd_run(ADIv5_DP_t *dp, struct jlink_swd_xfer *xfer,
+                          int count)
+{
+	const uint32_t pwrup = ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ |
+		ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ;
+	int done = 0;
+	if (!dp->fault) {
+		xfer[0] = (struct jlink_swd_xfer){ADIV5_LOW_WRITE,
+			ADIV5_DP_CTRLSTAT, pwrup | ADIV5_DP_CTRLSTAT_ORUNDETECT, 0};
+		xfer[count - 1] = (struct jlink_swd_xfer){ADIV5_LOW_WRITE,
+			ADIV5_DP_CTRLSTAT, pwrup, 0};
+		bool failed = false;
+		while ((done < count) && !failed)
+			done += jlink_swd_batch(xfer + done, count - done, &failed);
+		if (failed) {
+			uint8_t ack = xfer[done].ack;
+			if ((ack != SWDP_ACK_WAIT) && (ack != SWDP_ACK_FAULT))
+				line_reset(&info);
+			jlink_adiv5_swdp_low_access(dp, ADIV5_LOW_WRITE, ADIV5_DP_ABORT,
+			                            ADIV5_DP_ABORT_ORUNERRCLR);
+			jlink_adiv5_swdp_low_access(dp, ADIV5_LOW_WRITE,
+			                            ADIV5_DP_CTRLSTAT, pwrup);
+			if (!ack)
+				raise_exception(EXCEPTION_ERROR, "SWDP Parity error");
+		}
+	}
+	/* The framing CTRL/STAT writes are left out here */
+	for (int i = MAX(done, 1); i < count - 1; i++)
+		xfer[i].value = jlink_adiv5_swdp_low_access(dp, xfer[i].RnW,
+		                                            xfer[i].addr,
+		                                            xfer[i].value);
+}
+
+/* Queue selection of ap and the CSW and TAR setup for an access */
+static int jlink_mem_setup(struct jlink_swd_xfer *xfer, ADIv5_AP_t *ap,
+                           uint32_t addr, enum align align)
+{
+	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	switch (align) {
+	case ALIGN_BYTE:
+		csw |= ADIV5_AP_CSW_SIZE_BYTE;
+		break;
+	case ALIGN_HALFWORD:
+		csw |= ADIV5_AP_CSW_SIZE_HALFWORD;
+		break;
+	case ALIGN_DWORD:
+	case ALIGN_WORD:
+		csw |= ADIV5_AP_CSW_SIZE_WORD;
+		break;
+	}
+	/* Slot 0 is taken by the CTRL/STAT write of jlink_swd_run() */
+	xfer[1] = (struct jlink_swd_xfer){ADIV5_LOW_WRITE, ADIV5_DP_SELECT,
+	                                  (uint32_t)ap->apsel << 24, 0};
+	xfer[2] = (struct jlink_swd_xfer){ADIV5_LOW_WRITE, ADIV5_AP_CSW, csw, 0};
+	xfer[3] = (struct jlink_swd_xfer){ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr, 0};
+	return 4;
+}
+
+#define ALIGNOF(x) (((x) & 3) == 0 ? ALIGN_WORD :					\
+                    (((x) & 1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
+
+static void jlink_adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src,
+                                 size_t len)
+{
+	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	uint32_t mask = adiv5_ap_tar_mask(ap);
+	struct jlink_swd_xfer xfer[JLINK_MEM_CHUNK + 6];
+
+	while (len) {
+		/* Stay inside the auto-increment window */
+		size_t count = MIN(len, mask + 1 - (src & mask)) >> align;
+		if (count > JLINK_MEM_CHUNK)
+			count = JLINK_MEM_CHUNK;
+		int n = jlink_mem_setup(xfer, ap, src, align);
+		for (size_t i = 0; i < count; i++)
+			xfer[n++] = (struct jlink_swd_xfer){ADIV5_LOW_READ,
+			                                    ADIV5_AP_DRW, 0, 0};
+		xfer[n++] = (struct jlink_swd_xfer){ADIV5_LOW_READ,
+		                                    ADIV5_DP_RDBUFF, 0, 0};
+		n++;
+		jlink_swd_run(ap->dp, xfer, n);
+		/* Read data arrives with the transaction after the request */
+		for (size_t i = 0; i < count; i++)
+			dest = extract(dest, src + (i << align), xfer[5 + i].value,
+			               align);
+		src += count << align;
+		len -= count << align;
+	}
+}
+
+static void jlink_adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest,
+                                        const void *src, size_t len,
+                                        enum align align)
+{
+	uint32_t mask = adiv5_ap_tar_mask(ap);
+	struct jlink_swd_xfer xfer[JLINK_MEM_CHUNK + 5];
+
+	if (align > ALIGN_WORD)
+		align = ALIGN_WORD;
+
+	while (len) {
+		/* Stay inside the auto-increment window */
+		size_t count = MIN(len, mask + 1 - (dest & mask)) >> align;
+		if (count > JLINK_MEM_CHUNK)
+			count = JLINK_MEM_CHUNK;
+		int n = jlink_mem_setup(xfer, ap, dest, align);
+		for (size_t i = 0; i < count; i++) {
+			uint32_t at = dest + (i << align);
+			uint32_t tmp = 0;
+			/* Pack data into correct data lane */
+			switch (align) {
+			case ALIGN_BYTE:
+				tmp = ((uint32_t)*(uint8_t *)src) << ((at & 3) << 3);
+				break;
+			case ALIGN_HALFWORD:
+				tmp = ((uint32_t)*(uint16_t *)src) << ((at & 2) << 3);
+				break;
+			case ALIGN_DWORD:
+			case ALIGN_WORD:
+				memcpy(&tmp, src, 4);
+				break;
+			}
+			src = (uint8_t *)src + (1 << align);
+			xfer[n++] = (struct jlink_swd_xfer){ADIV5_LOW_WRITE,
+			                                    ADIV5_AP_DRW, tmp, 0};
+		}
+		n++;
+		jlink_swd_run(ap->dp, xfer, n);
+		dest += count << align;
+		len -= count << align;
+	}
+}
@@ -82,6 +82,9 @@ void platform_init(int argc, char **argv)
 		exit(-1);
 	}
 	bmp_ident(&info);
+	clock_autotune = cl_opts.opt_clock_autotune;
+	if (cl_opts.opt_scan_cache)
+		adiv5_scan_cache_init(cl_opts.opt_scan_cache, info.serial);
 	switch (info.bmp_type) {
 	case BMP_TYPE_BMP:
 		if (serial_open(&cl_opts, info.serial))
@@ -141,7 +144,7 @@ int platform_adiv5_swdp_scan(uint32_t targetid)
 		break;
 	}
 	case BMP_TYPE_JLINK:
-		return jlink_swdp_scan(&info);
+		return jlink_swdp_scan(&info, cl_opts.opt_jlink_batch);
 	default:
 		return 0;
 	}
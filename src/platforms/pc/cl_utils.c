@@ -32,6 +32,7 @@
 #include "target_internal.h"
 #include "cortexm.h"
 #include "command.h"
+#include "crc32.h"
 
 #include "cl_utils.h"
 #include "bmp_hosted.h"
@@ -152,7 +153,10 @@ static void cl_help(char **argv)
 	DEBUG_WARN("\tDefault mode is to start the debug server at :2000\n");
 	DEBUG_WARN("\t-j\t\t: Use JTAG. SWD is default.\n");
 	DEBUG_WARN("\t-f\t\t: Set minimum high and low times of SWJ waveform.\n");
+	DEBUG_WARN("\t\t\t  Use \"auto\" to tune the clock after each scan\n");
 	DEBUG_WARN("\t-C\t\t: Connect under hardware reset\n");
+	DEBUG_WARN("\t-k \"file\"\t: Keep scan results in <file> to speed up later\n"
+	           "\t\t\t  runs with the same probe and target\n");
 	DEBUG_WARN("\t-t\t\t: Scan SWD or JTAG and display information about \n"
 			   "\t\t\t  connected devices\n");
 	DEBUG_WARN("\t-T\t\t: Continuous read/write-back some value to allow\n"
@@ -167,6 +171,7 @@ static void cl_help(char **argv)
 	DEBUG_WARN("\t-p\t\t: Supplies power to the target (where applicable)\n");
 	DEBUG_WARN("\t-R[h]\t\t: Reset device. Default via SWJ or by hardware(h)\n");
 	DEBUG_WARN("\t-H\t\t: Do not use high level commands (BMP-Remote)\n");
+	DEBUG_WARN("\t-B\t\t: Batch SWD memory transfers (J-Link, experimental)\n");
 	DEBUG_WARN("\t-m <target>\t: Use (target)id for SWD multi-drop.\n");
 	DEBUG_WARN("\t-M <string>\t: Run target specific monitor commands. Quote multi\n");
 	DEBUG_WARN("\t\t\t  word strings. Run \"-M help\" for help.\n");
@@ -186,7 +191,7 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 	opt->opt_flash_size = 0xffffffff;
 	opt->opt_flash_start = 0xffffffff;
 	opt->opt_max_swj_frequency = 4000000;
-	while((c = getopt(argc, argv, "eEhHv:d:f:s:I:c:Cln:m:M:wVtTa:S:jpP:rR::")) != -1) {
+	while((c = getopt(argc, argv, "eEhHBv:d:f:s:I:c:Ck:ln:m:M:wVtTa:S:jpP:rR::")) != -1) {
 		switch(c) {
 		case 'c':
 			if (optarg)
@@ -199,6 +204,9 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'H':
 			opt->opt_no_hl = true;
 			break;
+		case 'B':
+			opt->opt_jlink_batch = true;
+			break;
 		case 'v':
 			if (optarg)
 				cl_debuglevel = strtol(optarg, NULL, 0) & (BMP_DEBUG_MAX - 1);
@@ -213,6 +221,10 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'C':
 			opt->opt_connect_under_reset = true;
 			break;
+		case 'k':
+			if (optarg)
+				opt->opt_scan_cache = optarg;
+			break;
 		case 'e':
 			opt->external_resistor_swd = true;
 			break;
@@ -221,7 +233,9 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 				opt->opt_device = optarg;
 			break;
 		case 'f':
-			if (optarg) {
+			if (optarg && !strcmp(optarg, "auto")) {
+				opt->opt_clock_autotune = true;
+			} else if (optarg) {
 				char *p;
 				uint32_t frequency = strtol(optarg, &p, 10);
 				switch(*p) {
@@ -491,6 +505,9 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 			  opt->opt_flash_start);
 		unsigned int erased = target_flash_erase(t, opt->opt_flash_start,
 												 opt->opt_flash_size);
+		/* Drivers may still have erase operations in flight */
+		if (!erased)
+			erased = target_flash_done(t);
 		if (erased) {
 			DEBUG_WARN("Erasure failed!\n");
 			res = -1;
@@ -535,6 +552,23 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 	if ((opt->opt_mode == BMP_MODE_FLASH_READ) ||
 	    (opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
 	    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
+		if (opt->opt_mode != BMP_MODE_FLASH_READ) {
+			/* Let the target checksum the flash if it can. Only read
+			 * back on mismatch, to find the failing region. */
+			uint32_t crc;
+			uint32_t start_time = platform_time_ms();
+			if (!target_crc32(t, &crc, opt->opt_flash_start, map.size)) {
+				if (crc == crc32_buf(map.data, map.size)) {
+					DEBUG_WARN("CRC verify succeeded for %d bytes in %" PRId32
+					           " ms\n", (int)map.size,
+					           platform_time_ms() - start_time);
+					if (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)
+						target_reset(t);
+					goto free_map;
+				}
+				DEBUG_WARN("CRC mismatch, reading back flash\n");
+			}
+		}
 #define WORKSIZE 0x1000
 		uint8_t *data = alloca(WORKSIZE);
 		if (!data) {
@@ -48,6 +48,8 @@ typedef struct BMP_CL_OPTIONS_s {
 	bool opt_connect_under_reset;
 	bool external_resistor_swd;
 	bool opt_no_hl;
+	bool opt_jlink_batch;
+	bool opt_clock_autotune;
 	char *opt_flash_file;
 	char *opt_device;
 	char *opt_serial;
@@ -56,6 +58,7 @@ typedef struct BMP_CL_OPTIONS_s {
 	int  opt_position;
 	char *opt_cable;
 	char *opt_monitor;
+	char *opt_scan_cache;
 	int opt_debuglevel;
 	int opt_target_dev;
 	uint32_t opt_flash_start;
@@ -340,7 +340,9 @@ static void remotePacketProcessHL(unsigned i, char *packet)
 	(void)i;
 	SET_IDLE_STATE(0);
 
-	ADIv5_AP_t remote_ap;
+	/* The host does not send packed support or the TAR window, leave
+	 * them clear so accesses stay unpacked and split at 1 KiB. */
+	ADIv5_AP_t remote_ap = {0};
 	/* Re-use packet buffer. Align to DWORD! */
 	void *src = (void *)(((uint32_t)packet + 7) & ~7);
 	char index = packet[1];
@@ -32,6 +32,16 @@
 #include "cortexm.h"
 #include "exception.h"
 
+#if PC_HOSTED == 1
+# include <ctype.h>
+# include <errno.h>
+# if !defined(_WIN32) && !defined(__CYGWIN__)
+#  include <fcntl.h>
+#  include <sys/file.h>
+#  include <unistd.h>
+# endif
+#endif
+
 /* All this should probably be defined in a dedicated ADIV5 header, so that they
  * are consistently named and accessible when needed in the codebase.
  */
@@ -43,6 +53,9 @@
 #define ARM_AP_TYPE_AXI  4
 #define ARM_AP_TYPE_AHB5 5
 
+#define AP_IDR_CLASS_MASK (0xf << 13)
+#define AP_IDR_CLASS_MEM  (0x8 << 13)
+
 /* ROM table CIDR values */
 #define CIDR0_OFFSET    0xFF0 /* DBGCID0 */
 #define CIDR1_OFFSET    0xFF4 /* DBGCID1 */
@@ -120,6 +133,9 @@ static const char * const cidc_debug_strings[] =
 #define DEVARCH_PRESENT (1u << 20)
 #define DEVARCH_ARCHID_MASK 0x0000FFFF
 
+/* ROM table entries read per block transfer */
+#define ROM_ENTRY_BLOCK 32
+
 enum arm_arch {
 	aa_nosupport,
 	aa_cortexm,
@@ -291,21 +307,366 @@ static uint32_t adiv5_mem_read32(ADIv5_AP_t *ap, uint32_t addr)
 	return ret;
 }
 
-static uint32_t adiv5_ap_read_id(ADIv5_AP_t *ap, uint32_t addr)
+/* Combine the low bytes of four ID register words */
+static uint32_t adiv5_id_bytes(const uint32_t *words)
 {
 	uint32_t res = 0;
-	for (int i = 0; i < 4; i++) {
-		uint32_t x = adiv5_mem_read32(ap, addr + 4 * i);
-		res |= (x & 0xff) << (i * 8);
-	}
+	for (int i = 0; i < 4; i++)
+		res |= (words[i] & 0xff) << (i * 8);
 	return res;
 }
 
 uint64_t adiv5_ap_read_pidr(ADIv5_AP_t *ap, uint32_t addr)
 {
-	uint64_t pidr = adiv5_ap_read_id(ap, addr + PIDR4_OFFSET);
-	pidr = pidr << 32 |     adiv5_ap_read_id(ap, addr + PIDR0_OFFSET);
-	return pidr;
+	/* PIDR4-7 are followed by PIDR0-3 */
+	uint32_t words[8];
+	adiv5_mem_read(ap, words, addr + PIDR4_OFFSET, sizeof(words));
+	return ((uint64_t)adiv5_id_bytes(&words[0]) << 32) |
+		adiv5_id_bytes(&words[4]);
+}
+
+#if PC_HOSTED == 1
+/* Blocks of component space read during the scan, keyed by DP and AP
+ * identity.  Re-scans in the same session, e.g. after a reset, walk the
+ * ROM tables from here instead of over the wire.
+ */
+struct component_block {
+	struct component_block *next;
+	uint32_t dp_idcode;
+	uint32_t dp_targetid;
+	uint32_t ap_idr;
+	uint8_t apsel;
+	uint32_t addr;
+	size_t len;
+	uint32_t data[];
+};
+static struct component_block *component_cache;
+
+/* APs found on a DP by a complete scan */
+struct ap_record {
+	struct ap_record *next;
+	uint32_t dp_idcode;
+	uint32_t dp_targetid;
+	uint8_t apsel;
+	uint32_t idr;
+};
+static struct ap_record *ap_cache;
+
+/* Optional on-disk copy of the above, shared by several probes */
+struct scan_cache_line {
+	struct scan_cache_line *next;
+	char line[];
+};
+static const char *scan_cache_file;
+static char scan_cache_probe[64];
+static struct scan_cache_line *scan_cache_other_probes;
+static bool scan_cache_dirty;
+
+static bool component_block_match(struct component_block *b, ADIv5_AP_t *ap)
+{
+	return (b->dp_idcode == ap->dp->idcode) &&
+		(b->dp_targetid == ap->dp->targetid) &&
+		(b->ap_idr == ap->idr) && (b->apsel == ap->apsel);
+}
+
+static void component_cache_flush(ADIv5_AP_t *ap)
+{
+	struct component_block **b = &component_cache;
+	while (*b) {
+		if (component_block_match(*b, ap)) {
+			struct component_block *next = (*b)->next;
+			free(*b);
+			*b = next;
+			scan_cache_dirty = true;
+		} else {
+			b = &(*b)->next;
+		}
+	}
+}
+
+/* Forget everything known about the APs of a DP */
+static void scan_cache_flush_dp(ADIv5_DP_t *dp)
+{
+	struct ap_record **r = &ap_cache;
+	while (*r) {
+		if (((*r)->dp_idcode == dp->idcode) &&
+		    ((*r)->dp_targetid == dp->targetid)) {
+			ADIv5_AP_t ap = {.dp = dp, .apsel = (*r)->apsel, .idr = (*r)->idr};
+			component_cache_flush(&ap);
+			struct ap_record *next = (*r)->next;
+			free(*r);
+			*r = next;
+			scan_cache_dirty = true;
+		} else {
+			r = &(*r)->next;
+		}
+	}
+}
+
+static struct ap_record *scan_cache_find_ap(ADIv5_DP_t *dp, int apsel)
+{
+	for (struct ap_record *r = ap_cache; r; r = r->next) {
+		if ((r->dp_idcode == dp->idcode) &&
+		    (r->dp_targetid == dp->targetid) &&
+		    ((apsel < 0) || (r->apsel == apsel)))
+			return r;
+	}
+	return NULL;
+}
+
+/* Highest APSEL of a cached topology, or -1 if the DP is not cached */
+static int scan_cache_last_ap(ADIv5_DP_t *dp)
+{
+	int last = -1;
+	for (struct ap_record *r = ap_cache; r; r = r->next) {
+		if ((r->dp_idcode == dp->idcode) &&
+		    (r->dp_targetid == dp->targetid) && (r->apsel > last))
+			last = r->apsel;
+	}
+	return last;
+}
+
+static void scan_cache_add_aps(ADIv5_DP_t *dp, int count,
+                               const uint8_t *apsel, const uint32_t *idr)
+{
+	for (int i = 0; i < count; i++) {
+		struct ap_record *r = malloc(sizeof(*r));
+		if (!r)
+			return;
+		r->dp_idcode = dp->idcode;
+		r->dp_targetid = dp->targetid;
+		r->apsel = apsel[i];
+		r->idr = idr[i];
+		r->next = ap_cache;
+		ap_cache = r;
+		scan_cache_dirty = true;
+	}
+}
+
+/* With others_only set, only the lines of other probes are kept */
+static void scan_cache_load_line(const char *line, bool others_only)
+{
+	char probe[64];
+	unsigned long idcode, targetid, idr, addr;
+	int apsel, n;
+	if (sscanf(line, "ap %63s %lx %lx %d %lx", probe, &idcode, &targetid,
+	           &apsel, &idr) == 5) {
+		if (strcmp(probe, scan_cache_probe))
+			goto other_probe;
+		if (others_only)
+			return;
+		ADIv5_DP_t dp = {.idcode = idcode, .targetid = targetid};
+		uint8_t sel = apsel;
+		uint32_t id = idr;
+		scan_cache_add_aps(&dp, 1, &sel, &id);
+		return;
+	}
+	if (sscanf(line, "blk %63s %lx %lx %d %lx %lx%n", probe, &idcode,
+	           &targetid, &apsel, &idr, &addr, &n) == 6) {
+		if (strcmp(probe, scan_cache_probe))
+			goto other_probe;
+		if (others_only)
+			return;
+		uint32_t data[64];
+		size_t words = 0;
+		const char *p = line + n;
+		char *end;
+		while (words < 64) {
+			unsigned long w = strtoul(p, &end, 16);
+			if (end == p)
+				break;
+			data[words++] = w;
+			p = end;
+		}
+		struct component_block *b = malloc(sizeof(*b) + words * 4);
+		if (!b)
+			return;
+		b->dp_idcode = idcode;
+		b->dp_targetid = targetid;
+		b->ap_idr = idr;
+		b->apsel = apsel;
+		b->addr = addr;
+		b->len = words * 4;
+		memcpy(b->data, data, b->len);
+		b->next = component_cache;
+		component_cache = b;
+	}
+	return;
+other_probe:;
+	struct scan_cache_line *l = malloc(sizeof(*l) + strlen(line) + 1);
+	if (!l)
+		return;
+	strcpy(l->line, line);
+	l->next = scan_cache_other_probes;
+	scan_cache_other_probes = l;
+}
+
+/* Read the cache file. Lines of other probes are kept in file order,
+ * replacing those read before. */
+static void scan_cache_read(FILE *f, bool others_only)
+{
+	while (scan_cache_other_probes) {
+		struct scan_cache_line *l = scan_cache_other_probes;
+		scan_cache_other_probes = l->next;
+		free(l);
+	}
+	char line[1024];
+	while (fgets(line, sizeof(line), f))
+		scan_cache_load_line(line, others_only);
+	/* Lines were prepended, other probes are written back in order */
+	struct scan_cache_line *rev = NULL;
+	while (scan_cache_other_probes) {
+		struct scan_cache_line *l = scan_cache_other_probes;
+		scan_cache_other_probes = l->next;
+		l->next = rev;
+		rev = l;
+	}
+	scan_cache_other_probes = rev;
+}
+
+/* Several processes may share the file. It is updated under a lock on
+ * a separate lock file: the lines of other probes are read again, all
+ * is written to a temporary file and that is renamed over the cache,
+ * so a reader never sees a partly written file. */
+static void scan_cache_save(void)
+{
+	if (!scan_cache_file || !scan_cache_dirty)
+		return;
+	size_t name_len = strlen(scan_cache_file) + 16;
+	char lock_name[name_len];
+	char tmp_name[name_len];
+	snprintf(lock_name, name_len, "%s.lock", scan_cache_file);
+	snprintf(tmp_name, name_len, "%s.tmp", scan_cache_file);
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+	int lock = open(lock_name, O_RDWR | O_CREAT, 0644);
+	if ((lock < 0) || flock(lock, LOCK_EX)) {
+		DEBUG_WARN("Can not lock scan cache %s: %s\n", lock_name,
+		           strerror(errno));
+		if (lock >= 0)
+			close(lock);
+		return;
+	}
+	snprintf(tmp_name, name_len, "%s.%d", scan_cache_file, (int)getpid());
+#endif
+	FILE *f = fopen(scan_cache_file, "r");
+	if (f) {
+		scan_cache_read(f, true);
+		fclose(f);
+	}
+	f = fopen(tmp_name, "w");
+	if (!f) {
+		DEBUG_WARN("Can not write scan cache %s: %s\n", tmp_name,
+		           strerror(errno));
+		goto out;
+	}
+	fprintf(f, "# Black Magic Debug scan cache\n");
+	for (struct scan_cache_line *l = scan_cache_other_probes; l; l = l->next)
+		fputs(l->line, f);
+	for (struct ap_record *r = ap_cache; r; r = r->next)
+		fprintf(f, "ap %s %08" PRIx32 " %08" PRIx32 " %d %08" PRIx32 "\n",
+		        scan_cache_probe, r->dp_idcode, r->dp_targetid, r->apsel,
+		        r->idr);
+	for (struct component_block *b = component_cache; b; b = b->next) {
+		fprintf(f, "blk %s %08" PRIx32 " %08" PRIx32 " %d %08" PRIx32
+		        " %08" PRIx32, scan_cache_probe, b->dp_idcode,
+		        b->dp_targetid, b->apsel, b->ap_idr, b->addr);
+		for (size_t i = 0; i < b->len / 4; i++)
+			fprintf(f, " %08" PRIx32, b->data[i]);
+		fprintf(f, "\n");
+	}
+	if (fclose(f)) {
+		DEBUG_WARN("Can not write scan cache %s: %s\n", tmp_name,
+		           strerror(errno));
+		remove(tmp_name);
+		goto out;
+	}
+#if defined(_WIN32) || defined(__CYGWIN__)
+	/* rename() does not replace an existing file here */
+	remove(scan_cache_file);
+#endif
+	if (rename(tmp_name, scan_cache_file)) {
+		DEBUG_WARN("Can not replace scan cache %s: %s\n", scan_cache_file,
+		           strerror(errno));
+		remove(tmp_name);
+		goto out;
+	}
+	scan_cache_dirty = false;
+out:
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+	flock(lock, LOCK_UN);
+	close(lock);
+#endif
+	return;
+}
+
+void adiv5_scan_cache_init(const char *file, const char *probe)
+{
+	scan_cache_file = file;
+	/* The probe serial is one token in the file */
+	snprintf(scan_cache_probe, sizeof(scan_cache_probe), "%s",
+	         (probe && probe[0]) ? probe : "-");
+	for (char *c = scan_cache_probe; *c; c++) {
+		if (isspace((unsigned char)*c))
+			*c = '_';
+	}
+	atexit(scan_cache_save);
+	FILE *f = fopen(file, "r");
+	if (!f)
+		return;
+	scan_cache_read(f, false);
+	fclose(f);
+	DEBUG_INFO("Using scan cache %s for probe %s\n", file, scan_cache_probe);
+}
+#endif
+
+/* Read a block of component space with a single block transfer and one
+ * sticky error check.  With verify set the block is always read from
+ * the target, and cached blocks for this AP are dropped if it differs.
+ */
+static bool adiv5_component_read(ADIv5_AP_t *ap, uint32_t *dest,
+                                 uint32_t addr, size_t len, bool verify)
+{
+#if PC_HOSTED == 1
+	struct component_block *b;
+	for (b = component_cache; b; b = b->next) {
+		if (component_block_match(b, ap) && (b->addr == addr) &&
+		    (b->len == len))
+			break;
+	}
+	if (b && !verify) {
+		memcpy(dest, b->data, len);
+		return true;
+	}
+#else
+	(void)verify;
+#endif
+	adiv5_dp_error(ap->dp);
+	adiv5_mem_read(ap, dest, addr, len);
+	if (ap->dp->fault || adiv5_dp_error(ap->dp))
+		return false;
+#if PC_HOSTED == 1
+	if (b) {
+		if (!memcmp(b->data, dest, len))
+			return true;
+		DEBUG_INFO("AP %d: Component at 0x%08" PRIx32 " changed, dropping "
+		           "cached scan\n", ap->apsel, addr);
+		component_cache_flush(ap);
+	}
+	b = malloc(sizeof(*b) + len);
+	if (!b)
+		return true;
+	scan_cache_dirty = true;
+	b->dp_idcode = ap->dp->idcode;
+	b->dp_targetid = ap->dp->targetid;
+	b->ap_idr = ap->idr;
+	b->apsel = ap->apsel;
+	b->addr = addr;
+	b->len = len;
+	memcpy(b->data, dest, len);
+	b->next = component_cache;
+	component_cache = b;
+#endif
+	return true;
 }
 
 /* Halt CortexM
@@ -439,13 +800,18 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 	addr &= 0xfffff000; /* Mask out base address */
 	if (addr == 0) /* No rom table on this AP */
 		return;
-	volatile uint32_t cidr;
-	cidr = adiv5_ap_read_id(ap, addr + CIDR0_OFFSET);
+	/* DEVARCH up to CIDR3 in one go, the top level table is always read
+	 * to validate any cached scan of this AP */
+	uint32_t ids[(CIDR3_OFFSET - DEVARCH_OFFSET) / 4 + 1];
+#define ID_WORD(offset) (&ids[((offset) - DEVARCH_OFFSET) / 4])
+	bool ids_ok = adiv5_component_read(ap, ids, addr + DEVARCH_OFFSET,
+	                                   sizeof(ids), recursion == 0);
 	if (ap->dp->fault) {
 		DEBUG_WARN("CIDR read timeout on AP%d, aborting.\n", ap->apsel);
 		return;
 	}
-	if ((cidr & ~CID_CLASS_MASK) != CID_PREAMBLE)
+	uint32_t cidr = adiv5_id_bytes(ID_WORD(CIDR0_OFFSET));
+	if (ids_ok && ((cidr & ~CID_CLASS_MASK) != CID_PREAMBLE))
 				return;
 #if defined(ENABLE_DEBUG)
 	char indent[recursion + 1];
@@ -454,7 +820,7 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 	indent[recursion] = 0;
 #endif
 
-	if (adiv5_dp_error(ap->dp)) {
+	if (!ids_ok) {
 		DEBUG_WARN("%sFault reading ID registers\n", indent);
 		return;
 	}
@@ -467,7 +833,8 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 		return;
 	}
 
-	uint64_t pidr = adiv5_ap_read_pidr(ap, addr);
+	uint64_t pidr = ((uint64_t)adiv5_id_bytes(ID_WORD(PIDR4_OFFSET)) << 32) |
+		adiv5_id_bytes(ID_WORD(PIDR0_OFFSET));
 	/* Extract Component ID class nibble */
 	uint32_t cid_class = (cidr & CID_CLASS_MASK) >> CID_CLASS_SHIFT;
 
@@ -505,10 +872,23 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 				}
 			}
 		}
+		/* Entries are read in blocks, the table is zero terminated.
+		 * A block may run past the terminator into locations that
+		 * fault, then the entries are read one at a time. Like the
+		 * IDs, the entries of the top level table are always read
+		 * to validate any cached scan. */
+		uint32_t entries[ROM_ENTRY_BLOCK];
+		bool by_block = true;
 		for (int i = 0; i < 960; i++) {
-			adiv5_dp_error(ap->dp);
-			uint32_t entry = adiv5_mem_read32(ap, addr + i*4);
-			if (adiv5_dp_error(ap->dp)) {
+			uint32_t entry;
+			if (by_block && ((i % ROM_ENTRY_BLOCK) == 0) &&
+			    !adiv5_component_read(ap, entries, addr + i*4,
+			                          sizeof(entries), recursion == 0))
+				by_block = false;
+			if (by_block) {
+				entry = entries[i % ROM_ENTRY_BLOCK];
+			} else if (!adiv5_component_read(ap, &entry, addr + i*4,
+			                                 sizeof(entry), recursion == 0)) {
 				DEBUG_WARN("%sFault reading ROM table entry %d\n", indent, i);
 				break;
 			}
@@ -543,9 +923,9 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 		uint16_t arch_id = 0;
 		uint8_t dev_type = 0;
 		if (cid_class == cidc_dc) {
-			dev_type = adiv5_mem_read32(ap, addr + DEVTYPE_OFFSET) & DEVTYPE_MASK;
+			dev_type = *ID_WORD(DEVTYPE_OFFSET) & DEVTYPE_MASK;
 
-			uint32_t devarch = adiv5_mem_read32(ap, addr + DEVARCH_OFFSET);
+			uint32_t devarch = *ID_WORD(DEVARCH_OFFSET);
 
 			if (devarch & DEVARCH_PRESENT) {
 				arch_id = devarch & DEVARCH_ARCHID_MASK;
@@ -601,9 +981,36 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 				  (uint32_t)(pidr >> 32), (uint32_t)pidr, dev_type, arch_id);
 		}
 	}
+#undef ID_WORD
 	return;
 }
 
+/* Find how far TAR auto-increments.  One word is read from the end of
+ * the 4 KiB ROM table page, which is always readable, and TAR read
+ * back: it has either carried into the next page or wrapped back to the
+ * start of the auto-increment window.  Expects CSW set for single word
+ * increments.
+ */
+static void adiv5_ap_tar_window_probe(ADIv5_AP_t *ap)
+{
+	uint32_t page = ap->base & ~0xfff;
+	adiv5_dp_error(ap->dp);
+	adiv5_ap_write(ap, ADIV5_AP_TAR, page | 0xffc);
+	adiv5_ap_read(ap, ADIV5_AP_DRW);
+	uint32_t tar = adiv5_ap_read(ap, ADIV5_AP_TAR);
+	if (ap->dp->fault || adiv5_dp_error(ap->dp))
+		return;
+	if (tar == page + 0x1000)
+		ap->tar_mask = 0xfff;
+	else if ((tar & ~0xfff) == page)
+		ap->tar_mask = 0xfff - (tar & 0xfff);
+	/* Anything else is not understood, stay with the 1 KiB minimum */
+	if (ap->tar_mask && (ap->tar_mask < 0x3ff || (ap->tar_mask & (ap->tar_mask + 1))))
+		ap->tar_mask = 0;
+	DEBUG_INFO("AP %d: TAR auto-increment window %" PRIu32 " bytes\n",
+	           ap->apsel, adiv5_ap_tar_mask(ap) + 1);
+}
+
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 {
 	ADIv5_AP_t *ap, tmpap;
@@ -633,6 +1040,20 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 		return NULL;
 	}
 
+	if ((tmpap.idr & AP_IDR_CLASS_MASK) == AP_IDR_CLASS_MEM) {
+		/* Packed transfers are optional, AddrInc does not read back as
+		 * packed if they are not implemented */
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw |
+		               ADIV5_AP_CSW_ADDRINC_PACKED | ADIV5_AP_CSW_SIZE_BYTE);
+		uint32_t csw = adiv5_ap_read(&tmpap, ADIV5_AP_CSW);
+		tmpap.packed = (csw & ADIV5_AP_CSW_ADDRINC_MASK) ==
+			ADIV5_AP_CSW_ADDRINC_PACKED;
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw |
+		               ADIV5_AP_CSW_ADDRINC_SINGLE | ADIV5_AP_CSW_SIZE_WORD);
+		if (tmpap.base & 1)
+			adiv5_ap_tar_window_probe(&tmpap);
+	}
+
 	/* It's valid to so create a heap copy */
 	ap = malloc(sizeof(*ap));
 	if (!ap) {			/* malloc failed: heap exhaustion */
@@ -668,6 +1089,124 @@ static void rp_rescue_setup(ADIv5_DP_t *dp)
 	return;
 }
 
+/* Clock auto-tuning searches between these bounds and keeps a
+ * margin below the fastest clock that passed the link test. */
+#define TUNE_FREQ_MIN     100000
+#define TUNE_FREQ_MAX   50000000
+#define TUNE_ROUNDS           32
+
+/* Hammer the DP with reads and, where MASKLANE is writable, write and
+ * readback patterns.  Only DP registers are used, so this is safe to
+ * run before any AP or target is known. */
+static bool adiv5_dp_link_test(ADIv5_DP_t *dp, uint32_t dpidr, bool masklane)
+{
+	const uint32_t pwrup = ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ |
+		ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ;
+	const uint32_t pwrack = ADIV5_DP_CTRLSTAT_CSYSPWRUPACK |
+		ADIV5_DP_CTRLSTAT_CDBGPWRUPACK;
+	volatile bool ok = true;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		dp->resync(dp);
+		adiv5_dp_error(dp);
+		for (int i = 0; ok && (i < TUNE_ROUNDS); i++) {
+			uint32_t lane = (i & 1) ? 0xa : 0x5;
+			if (masklane)
+				adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, pwrup | (lane << 8));
+			if (dpidr && (adiv5_dp_read(dp, ADIV5_DP_IDCODE) != dpidr))
+				ok = false;
+			uint32_t ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+			if ((ctrlstat & pwrack) != pwrack)
+				ok = false;
+			if (masklane && (((ctrlstat >> 8) & 0xf) != lane))
+				ok = false;
+			if (dp->fault)
+				ok = false;
+		}
+		if (masklane)
+			adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, pwrup);
+	}
+	if (e.type || dp->fault)
+		ok = false;
+	return ok;
+}
+
+/* Request a clock and return the one the probe actually runs at */
+static uint32_t adiv5_dp_clock_set(uint32_t freq)
+{
+	platform_max_frequency_set(freq);
+	return platform_max_frequency_get();
+}
+
+/* Binary search the fastest clock the link test passes at, starting
+ * from the configured one, and back off by a quarter from there.
+ * Probes round the requested clock, so the search runs on requested
+ * values while the result is taken from the clocks actually reached. */
+static void adiv5_dp_clock_tune(ADIv5_DP_t *dp)
+{
+	const uint32_t pwrup = ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ |
+		ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ;
+	uint32_t orig = platform_max_frequency_get();
+	if (orig == FREQ_FIXED)
+		return;
+	/* Failed link tests leave the DP in an unknown state */
+	if (!dp->resync) {
+		DEBUG_INFO("Clock tuning not supported by this probe\n");
+		return;
+	}
+	/* Reference values at the configured clock */
+	volatile uint32_t dpidr = 0;
+	volatile bool masklane = false;
+	volatile struct exception e;
+	TRY_CATCH (e, EXCEPTION_ALL) {
+		dpidr = adiv5_dp_read(dp, ADIV5_DP_IDCODE);
+		adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, pwrup | (0xa << 8));
+		masklane = ((adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT) >> 8) & 0xf) == 0xa;
+		adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, pwrup);
+	}
+	uint32_t lo, hi, best;
+	if (!e.type && adiv5_dp_link_test(dp, dpidr, masklane)) {
+		lo = best = orig;
+		hi = TUNE_FREQ_MAX;
+	} else {
+		hi = orig;
+		lo = best = adiv5_dp_clock_set(TUNE_FREQ_MIN);
+		if (!adiv5_dp_link_test(dp, dpidr, masklane)) {
+			DEBUG_WARN("Clock tuning failed, link unreliable even at %"
+			           PRIu32 " Hz\n", best);
+			platform_max_frequency_set(orig);
+			return;
+		}
+	}
+	if (hi > lo) {
+		uint32_t reached = adiv5_dp_clock_set(hi);
+		/* No point searching above what the probe can do */
+		if (reached < hi)
+			hi = reached;
+		if (adiv5_dp_link_test(dp, dpidr, masklane))
+			lo = best = hi;
+	}
+	while ((hi > lo) && ((hi - lo) > (lo / 8))) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint32_t reached = adiv5_dp_clock_set(mid);
+		if (adiv5_dp_link_test(dp, dpidr, masklane)) {
+			lo = mid;
+			if (reached > best)
+				best = reached;
+		} else {
+			hi = mid;
+		}
+	}
+	uint32_t freq = best - best / 4;
+	if (freq < TUNE_FREQ_MIN)
+		freq = TUNE_FREQ_MIN;
+	uint32_t reached = adiv5_dp_clock_set(freq);
+	/* Leave the link in a sane state after the failed runs */
+	adiv5_dp_link_test(dp, dpidr, masklane);
+	DEBUG_INFO("Clock tuned: fastest pass %" PRIu32 " Hz, using %" PRIu32
+	           " Hz\n", best, reached);
+}
+
 void adiv5_dp_init(ADIv5_DP_t *dp)
 {
 #define DPIDR_PARTNO_MASK 0x0ff00000
@@ -733,6 +1272,8 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 			return;
 		}
 	}
+	if (clock_autotune)
+		adiv5_dp_clock_tune(dp);
 	/* This AP reset logic is described in ADIv5, but fails to work
 	 * correctly on STM32.	CDBGRSTACK is never asserted, and we
 	 * just wait forever.  This scenario is described in B2.4.1
@@ -763,11 +1304,43 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 	uint32_t last_base = 0;
 	int void_aps = 0;
 	dp->refcnt++;
+#if PC_HOSTED == 1
+	/* With a cached topology only the known APs are visited.  Should
+	 * one not match, the cache for this DP is dropped and the APs not
+	 * visited yet are scanned as usual. */
+	int last_ap = scan_cache_last_ap(dp);
+	uint8_t visited[256 / 8] = {0};
+	uint8_t found_apsel[256];
+	uint32_t found_idr[256];
+	int found = 0;
+#endif
 	for(int i = 0; (i < 256) && (void_aps < 8); i++) {
 		ADIv5_AP_t *ap = NULL;
 #if PC_HOSTED == 1
+		struct ap_record *cached = NULL;
+		if (last_ap >= 0) {
+			if (i > last_ap)
+				break;
+			cached = scan_cache_find_ap(dp, i);
+			if (!cached)
+				continue;
+		} else if (visited[i / 8] & (1 << (i % 8))) {
+			continue;
+		}
 		if ((!dp->ap_setup) || dp->ap_setup(i))
 			ap = adiv5_new_ap(dp, i);
+		if (cached && (!ap || (ap->idr != cached->idr))) {
+			DEBUG_INFO("AP %d: Does not match scan cache, rescanning\n", i);
+			if (ap)
+				adiv5_ap_unref(ap);
+			if (dp->ap_cleanup)
+				dp->ap_cleanup(i);
+			scan_cache_flush_dp(dp);
+			last_ap = -1;
+			i = -1;
+			continue;
+		}
+		visited[i / 8] |= 1 << (i % 8);
 #else
 		ap = adiv5_new_ap(dp, i);
 #endif
@@ -789,6 +1362,10 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 #if PC_HOSTED == 1
 			if (dp->ap_cleanup)
 				dp->ap_cleanup(i);
+#endif
+#if PC_HOSTED == 1
+			if (last_ap < 0)
+				scan_cache_add_aps(dp, found, found_apsel, found_idr);
 #endif
 			adiv5_ap_unref(ap);
 			adiv5_dp_unref(dp);
@@ -796,6 +1373,10 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 			return;
 		}
 		last_base = ap->base;
+#if PC_HOSTED == 1
+		found_apsel[found] = i;
+		found_idr[found++] = ap->idr;
+#endif
 		extern void kinetis_mdm_probe(ADIv5_AP_t *);
 		kinetis_mdm_probe(ap);
 
@@ -816,6 +1397,10 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 		adiv5_component_probe(ap, ap->base, 0, 0);
 		adiv5_ap_unref(ap);
 	}
+#if PC_HOSTED == 1
+	if (last_ap < 0)
+		scan_cache_add_aps(dp, found, found_apsel, found_idr);
+#endif
 	/* We halted at least CortexM for Romtable scan.
 	 * With connect under reset, keep the devices halted.
 	 * Otherwise, release the devices now.
@@ -832,10 +1417,13 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 #define ALIGNOF(x) (((x) & 3) == 0 ? ALIGN_WORD : \
                     (((x) & 1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
-/* Program the CSW and TAR for sequencial access at a given width */
-static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
+/* Program the CSW and TAR for sequencial access at a given width,
+ * packed puts a whole word of such accesses in each DRW transfer */
+static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align,
+                                bool packed)
 {
-	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	uint32_t csw = ap->csw | (packed ? ADIV5_AP_CSW_ADDRINC_PACKED :
+	                                   ADIV5_AP_CSW_ADDRINC_SINGLE);
 
 	switch (align) {
 	case ALIGN_BYTE:
@@ -871,25 +1459,42 @@ void * extract(void *dest, uint32_t src, uint32_t val, enum align align)
 	return (uint8_t *)dest + (1 << align);
 }
 
-void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+/* Split a byte or halfword transfer into a head and tail done one
+ * access per DRW transfer and a word aligned body done packed.
+ * Returns the body length, 0 if packing is not worthwhile.
+ */
+size_t adiv5_mem_packed_split(ADIv5_AP_t *ap, uint32_t addr, size_t len,
+                              enum align align, size_t *head)
+{
+	if (!ap->packed || (align >= ALIGN_WORD) || (len < 8))
+		return 0;
+	*head = (4 - (addr & 3)) & 3;
+	return (len - *head) & ~3;
+}
+
+static void ap_mem_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
+                              size_t len, enum align align, bool packed)
 {
 	uint32_t tmp;
 	uint32_t osrc = src;
-	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	/* Data per DRW transfer */
+	enum align lane = packed ? ALIGN_WORD : align;
 
-	if (len == 0)
-		return;
-
-	len >>= align;
-	ap_mem_access_setup(ap, src, align);
+	len >>= lane;
+	ap_mem_access_setup(ap, src, align, packed);
 	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 	while (--len) {
 		tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
-		dest = extract(dest, src, tmp, align);
+		if (packed) {
+			memcpy(dest, &tmp, 4);
+			dest = (uint8_t *)dest + 4;
+		} else {
+			dest = extract(dest, src, tmp, align);
+		}
 
-		src += (1 << align);
-		/* Check for 10 bit address overflow */
-		if ((src ^ osrc) & 0xfffffc00) {
+		src += (1 << lane);
+		/* Check for leaving the auto-increment window */
+		if ((src ^ osrc) & ~adiv5_ap_tar_mask(ap)) {
 			osrc = src;
 			adiv5_dp_low_access(ap->dp,
 					ADIV5_LOW_WRITE, ADIV5_AP_TAR, src);
@@ -898,42 +1503,195 @@ void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 		}
 	}
 	tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
-	extract(dest, src, tmp, align);
+	if (packed)
+		memcpy(dest, &tmp, 4);
+	else
+		extract(dest, src, tmp, align);
 }
 
-void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
-							size_t len, enum align align)
+void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
-	uint32_t odest = dest;
+	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	size_t head = 0;
+
+	if (len == 0)
+		return;
 
-	len >>= align;
-	ap_mem_access_setup(ap, dest, align);
-	while (len--) {
+	size_t body = adiv5_mem_packed_split(ap, src, len, align, &head);
+	if (body) {
+		uint8_t *d = dest;
+		firmware_mem_read(ap, d, src, head);
+		ap_mem_read_block(ap, d + head, src + head, body, align, true);
+		firmware_mem_read(ap, d + head + body, src + head + body,
+		                  len - head - body);
+		return;
+	}
+	ap_mem_read_block(ap, dest, src, len, align, false);
+}
+
+/* Words packed per ap_write_stream call */
+#define STREAM_MAX 32
+
+/* Pack count transfers from src into the data lanes used at dest */
+static const void *ap_mem_pack(uint32_t *data, const void *src,
+                               uint32_t dest, size_t count, enum align lane)
+{
+	for (size_t i = 0; i < count; i++) {
+		uint32_t at = dest + (i << lane);
 		uint32_t tmp = 0;
-		/* Pack data into correct data lane */
-		switch (align) {
+		switch (lane) {
 		case ALIGN_BYTE:
-			tmp = ((uint32_t)*(uint8_t *)src) << ((dest & 3) << 3);
+			tmp = ((uint32_t)*(uint8_t *)src) << ((at & 3) << 3);
 			break;
 		case ALIGN_HALFWORD:
-			tmp = ((uint32_t)*(uint16_t *)src) << ((dest & 2) << 3);
+			tmp = ((uint32_t)*(uint16_t *)src) << ((at & 2) << 3);
 			break;
 		case ALIGN_DWORD:
 		case ALIGN_WORD:
-			tmp = *(uint32_t *)src;
+			memcpy(&tmp, src, 4);
 			break;
 		}
-		src = (uint8_t *)src + (1 << align);
-		dest += (1 << align);
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, tmp);
+		data[i] = tmp;
+		src = (uint8_t *)src + (1 << lane);
+	}
+	return src;
+}
 
-		/* Check for 10 bit address overflow */
-		if ((dest ^ odest) & 0xfffffc00) {
-			odest = dest;
-			adiv5_dp_low_access(ap->dp,
-					ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
+/* Write count transfers to DRW, streamed or one ACK checked write at a
+ * time.  Returns false if a streamed write was not acknowledged. */
+static bool ap_mem_write_run(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+                             size_t count, enum align lane, bool stream)
+{
+	uint32_t data[STREAM_MAX];
+	bool acked = true;
+
+	while (count) {
+		size_t n = MIN(count, STREAM_MAX);
+		src = ap_mem_pack(data, src, dest, n, lane);
+		if (stream) {
+			if (!ap->dp->ap_write_stream(ap->dp, ADIV5_AP_DRW, data, n))
+				acked = false;
+		} else {
+			for (size_t i = 0; i < n; i++)
+				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE,
+				                    ADIV5_AP_DRW, data[i]);
 		}
+		dest += n << lane;
+		count -= n;
+	}
+	return acked;
+}
+
+/* Check CTRL/STAT after streamed writes.  On an overrun, overrun
+ * detection is switched off again, as ACK checked accesses can't be
+ * used while it is on.  A bus fault is left in STICKYERR for the
+ * caller's error check. */
+static bool ap_mem_stream_check(ADIv5_DP_t *dp, bool acked)
+{
+	const uint32_t pwrup = ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ |
+		ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ;
+	uint32_t ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+	if (acked && !dp->fault &&
+	    !(ctrlstat & (ADIV5_DP_CTRLSTAT_STICKYORUN |
+	                  ADIV5_DP_CTRLSTAT_STICKYERR)))
+		return true;
+	/* Resync: the ABORT write is accepted even while overrun */
+	adiv5_dp_write(dp, ADIV5_DP_ABORT, ADIV5_DP_ABORT_ORUNERRCLR);
+	adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, pwrup);
+	if (ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR)
+		dp->fault = 1;
+	return false;
+}
+
+/* Overrun detection stays on for the whole block, so the ACKs of a
+ * streamed auto-increment window cost one CTRL/STAT read at its end.
+ * After an overrun TAR tells how far the target got, and the rest of
+ * the block goes out as ACK checked writes. */
+static void ap_mem_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+                               size_t len, enum align align, bool packed)
+{
+	const uint32_t pwrup = ADIV5_DP_CTRLSTAT_CSYSPWRUPREQ |
+		ADIV5_DP_CTRLSTAT_CDBGPWRUPREQ;
+	/* Data per DRW transfer */
+	enum align lane = packed ? ALIGN_WORD : align;
+	uint32_t mask = adiv5_ap_tar_mask(ap);
+	ADIv5_DP_t *dp = ap->dp;
+	bool stream = dp->ap_write_stream && ((len >> lane) > 1);
+
+	if (len == 0)
+		return;
+	ap_mem_access_setup(ap, dest, align, packed);
+	if (stream) {
+		adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT,
+		               pwrup | ADIV5_DP_CTRLSTAT_ORUNDETECT);
+		if (dp->fault)
+			return;
+	}
+	while (len) {
+		/* Stay inside the auto-increment window */
+		size_t count = MIN(len, mask + 1 - (dest & mask)) >> lane;
+		size_t done = 0;
+		if (stream) {
+			bool acked = ap_mem_write_run(ap, dest, src, count, lane, true);
+			if (ap_mem_stream_check(dp, acked)) {
+				done = count;
+			} else {
+				stream = false;
+				if (dp->fault)
+					return;
+				uint32_t tar = adiv5_ap_read(ap, ADIV5_AP_TAR);
+				if (dp->fault)
+					return;
+				/* An overrun stops TAR inside this window */
+				done = MIN((size_t)((tar - dest) >> lane), count);
+				DEBUG_WARN("SWD overrun at 0x%08" PRIx32
+				           ", falling back to checked writes\n", tar);
+				adiv5_dp_low_access(dp, ADIV5_LOW_WRITE,
+				                    ADIV5_AP_TAR, dest + (done << lane));
+			}
+		}
+		if (done < count)
+			ap_mem_write_run(ap, dest + (done << lane),
+			                 (const uint8_t *)src + (done << lane),
+			                 count - done, lane, false);
+		dest += count << lane;
+		src = (const uint8_t *)src + (count << lane);
+		len -= count << lane;
+
+		/* Reload TAR when leaving the auto-increment window */
+		if (len && !(dest & mask)) {
+			if (!stream) {
+				adiv5_dp_low_access(dp, ADIV5_LOW_WRITE,
+				                    ADIV5_AP_TAR, dest);
+			} else if (!dp->ap_write_stream(dp, ADIV5_AP_TAR, &dest, 1)) {
+				/* The window before was checked complete */
+				stream = false;
+				ap_mem_stream_check(dp, false);
+				if (dp->fault)
+					return;
+				adiv5_dp_low_access(dp, ADIV5_LOW_WRITE,
+				                    ADIV5_AP_TAR, dest);
+			}
+		}
+	}
+	if (stream)
+		adiv5_dp_write(dp, ADIV5_DP_CTRLSTAT, pwrup);
+}
+
+void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+							size_t len, enum align align)
+{
+	size_t head = 0;
+	size_t body = adiv5_mem_packed_split(ap, dest, len, align, &head);
+	if (body) {
+		const uint8_t *s = src;
+		ap_mem_write_block(ap, dest, s, head, align, false);
+		ap_mem_write_block(ap, dest + head, s + head, body, align, true);
+		ap_mem_write_block(ap, dest + head + body, s + head + body,
+		                   len - head - body, align, false);
+		return;
 	}
+	ap_mem_write_block(ap, dest, src, len, align, false);
 }
 
 void firmware_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
@@ -174,6 +174,14 @@ typedef struct ADIv5_DP_s {
 	uint32_t (*low_access)(struct ADIv5_DP_s *dp, uint8_t RnW,
                                uint16_t addr, uint32_t value);
 	void (*abort)(struct ADIv5_DP_s *dp, uint32_t abort);
+	/* Optional: Write count values to one AP register without waiting
+	 * on each ACK, with ORUNDETECT already set in CTRL/STAT.  Returns
+	 * false if any ACK was not OK. */
+	bool (*ap_write_stream)(struct ADIv5_DP_s *dp, uint16_t addr,
+	                        const uint32_t *data, size_t count);
+	/* Optional: Bring the wire protocol back to a known state after
+	 * transfers went wrong, e.g. at a too high clock. */
+	void (*resync)(struct ADIv5_DP_s *dp);
 
 #if PC_HOSTED == 1
 	bmp_type_t dp_bmp_type;
@@ -209,10 +217,18 @@ struct ADIv5_AP_s {
 	uint32_t ap_storage; /* E.g to hold STM32F7 initial DBGMCU_CR value.*/
 	uint16_t ap_designer;
 	uint16_t ap_partno;
+	bool packed; /* MEM-AP supports packed byte/halfword transfers */
+	uint32_t tar_mask; /* TAR auto-increment window - 1, 0 if not known */
 };
 
 unsigned int make_packet_request(uint8_t RnW, uint16_t addr);
 
+/* TAR only auto-increments within this window, 1 KiB is the minimum */
+static inline uint32_t adiv5_ap_tar_mask(ADIv5_AP_t *ap)
+{
+	return ap->tar_mask ? ap->tar_mask : 0x3ff;
+}
+
 #if PC_HOSTED == 0
 static inline uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
@@ -291,6 +307,11 @@ int swdptap_init(ADIv5_DP_t *dp);
 
 void adiv5_mem_write(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len);
 uint64_t adiv5_ap_read_pidr(ADIv5_AP_t *ap, uint32_t addr);
+size_t adiv5_mem_packed_split(ADIv5_AP_t *ap, uint32_t addr, size_t len,
+                              enum align align, size_t *head);
+#if PC_HOSTED == 1
+void adiv5_scan_cache_init(const char *file, const char *probe);
+#endif
 void * extract(void *dest, uint32_t src, uint32_t val, enum align align);
 
 void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
@@ -307,6 +328,9 @@ uint32_t firmware_swdp_read(ADIv5_DP_t *dp, uint16_t addr);
 uint32_t fw_adiv5_jtagdp_read(ADIv5_DP_t *dp, uint16_t addr);
 
 uint32_t firmware_swdp_error(ADIv5_DP_t *dp);
+bool firmware_swdp_ap_write_stream(ADIv5_DP_t *dp, uint16_t addr,
+                                   const uint32_t *data, size_t count);
+void firmware_swdp_resync(ADIv5_DP_t *dp);
 
 void firmware_swdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 void adiv5_jtagdp_abort(ADIv5_DP_t *dp, uint32_t abort);
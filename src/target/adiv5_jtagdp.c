@@ -38,6 +38,7 @@
 #define IR_APACC	0xB
 
 static uint32_t adiv5_jtagdp_error(ADIv5_DP_t *dp);
+static void adiv5_jtagdp_resync(ADIv5_DP_t *dp);
 
 void adiv5_jtag_dp_handler(uint8_t jd_index)
 {
@@ -54,13 +55,36 @@ void adiv5_jtag_dp_handler(uint8_t jd_index)
 		dp->error = adiv5_jtagdp_error;
 		dp->low_access = fw_adiv5_jtagdp_low_access;
 		dp->abort = adiv5_jtagdp_abort;
+		dp->resync = adiv5_jtagdp_resync;
 	}
 	adiv5_dp_init(dp);
 }
 
+/* Return all TAPs to Run-Test/Idle.  The reset loads IDCODE or BYPASS
+ * into every IR, so forget the cached IR values. */
+static void adiv5_jtagdp_resync(ADIv5_DP_t *dp)
+{
+	(void)dp;
+	jtag_proc.jtagtap_reset();
+	for (int i = 0; i < jtag_dev_count; i++)
+		jtag_devs[i].current_ir = -1;
+}
+
+/* AP registers that access memory when read */
+static bool adiv5_jtagdp_ap_read_has_side_effects(uint16_t addr)
+{
+	uint8_t reg = addr & 0xff;
+	return (reg == (ADIV5_AP_DRW & 0xff)) || ((reg & 0xf0) == 0x10);
+}
+
 uint32_t fw_adiv5_jtagdp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
 	fw_adiv5_jtagdp_low_access(dp, ADIV5_LOW_READ, addr, 0);
+	/* The posted result comes back with the next APACC or DPACC scan.
+	 * Repeating a side effect free AP read keeps the IR at APACC, so
+	 * there is no switch to DPACC for RDBUFF and back again. */
+	if ((addr & ADIV5_APnDP) && !adiv5_jtagdp_ap_read_has_side_effects(addr))
+		return fw_adiv5_jtagdp_low_access(dp, ADIV5_LOW_READ, addr, 0);
 	return fw_adiv5_jtagdp_low_access(dp, ADIV5_LOW_READ,
 					ADIV5_DP_RDBUFF, 0);
 }
@@ -61,6 +61,68 @@ bool firmware_dp_low_write(ADIv5_DP_t *dp, uint16_t addr, const uint32_t data)
 	return (res != 1);
 }
 
+/* TARGETSEL value of the DP selected last on a multi-drop bus */
+static uint32_t selected_targetid;
+
+/* Select dp on a multi-drop bus if another DP was accessed last */
+static void dp_select(ADIv5_DP_t *dp)
+{
+	if ((dp->targetid == selected_targetid) || !dp->dp_low_write ||
+	    ((dp->idcode & ADIV5_DP_VERSION_MASK) != ADIV5_DPv2))
+		return;
+	selected_targetid = dp->targetid;
+	dp_line_reset(dp);
+	dp->dp_low_write(dp, ADIV5_DP_TARGETSEL, dp->targetid);
+	dp->dp_read(dp, ADIV5_DP_IDCODE);
+}
+
+/* Template DP of the last multi-drop capable scan, so further parts on
+ * the same bus can be added without a new scan */
+static ADIv5_DP_t multidrop_bus;
+static bool multidrop_bus_valid;
+
+/* Probe all instances of target_id, creating a DP for each responding
+ * one.  Returns the number of DPs found. */
+static int swdp_scan_dps(ADIv5_DP_t *initial_dp, uint32_t target_id,
+                         uint32_t dp_idcode, bool scan_multidrop)
+{
+	volatile struct exception e;
+	volatile int found = 0;
+	volatile uint32_t idcode = dp_idcode;
+	volatile int nr_dps = (scan_multidrop) ? 16: 1;
+	volatile uint32_t dp_targetid;
+	for (volatile int i = 0; i < nr_dps; i++) {
+		if (scan_multidrop) {
+			dp_line_reset(initial_dp);
+			dp_targetid = (i << 28) | (target_id & 0x0fffffff);
+			initial_dp->dp_low_write(initial_dp, ADIV5_DP_TARGETSEL,
+									dp_targetid);
+			selected_targetid = dp_targetid;
+			initial_dp->fault = 0;
+			TRY_CATCH (e, EXCEPTION_ALL) {
+				idcode = initial_dp->dp_read(initial_dp, ADIV5_DP_IDCODE);
+			}
+			if (e.type || initial_dp->fault) {
+				continue;
+			}
+		} else {
+			dp_targetid = target_id;
+			selected_targetid = dp_targetid;
+		}
+		ADIv5_DP_t *dp = (void*)calloc(1, sizeof(*dp));
+		if (!dp) {			/* calloc failed: heap exhaustion */
+			DEBUG_WARN("calloc: failed in %s\n", __func__);
+			continue;
+		}
+		memcpy(dp, initial_dp, sizeof(ADIv5_DP_t));
+		dp->idcode = idcode;
+		dp->targetid = dp_targetid;
+		adiv5_dp_init(dp);
+		found++;
+	}
+	return found;
+}
+
 /* Try first the dormant to SWD procedure.
  * If target id given, scan DPs 0 .. 15 on that device and return.
  * Otherwise
@@ -69,6 +131,7 @@ int adiv5_swdp_scan(uint32_t targetid)
 {
 	volatile struct exception e;
 	target_list_free();
+	multidrop_bus_valid = false;
 	ADIv5_DP_t idp = {
 		.dp_low_write = firmware_dp_low_write,
 		.error = firmware_swdp_error,
@@ -79,6 +142,10 @@ int adiv5_swdp_scan(uint32_t targetid)
 	ADIv5_DP_t *initial_dp = &idp;
 	if (swdptap_init(initial_dp))
 		return -1;
+	/* Streaming needs the bit level SWD access of this file */
+	if (initial_dp->low_access == firmware_swdp_low_access)
+		initial_dp->ap_write_stream = firmware_swdp_ap_write_stream;
+	initial_dp->resync = firmware_swdp_resync;
 	/* DORMANT-> SWD sequence*/
 	initial_dp->seq_out(0xFFFFFFFF, 32);
 	initial_dp->seq_out(0xFFFFFFFF, 32);
@@ -143,37 +210,29 @@ int adiv5_swdp_scan(uint32_t targetid)
 	} else {
 		target_id = targetid;
 	}
-	volatile int nr_dps = (scan_multidrop) ? 16: 1;
-	volatile uint32_t dp_targetid;
-	for (volatile int i = 0; i < nr_dps; i++) {
-		if (scan_multidrop) {
-			dp_line_reset(initial_dp);
-			dp_targetid = (i << 28) | (target_id & 0x0fffffff);
-			initial_dp->dp_low_write(initial_dp, ADIV5_DP_TARGETSEL,
-									dp_targetid);
-			TRY_CATCH (e, EXCEPTION_ALL) {
-				idcode = initial_dp->dp_read(initial_dp, ADIV5_DP_IDCODE);
-			}
-			if (e.type || initial_dp->fault) {
-				continue;
-			}
-		} else {
-			dp_targetid = target_id;
-		}
-		ADIv5_DP_t *dp = (void*)calloc(1, sizeof(*dp));
-		if (!dp) {			/* calloc failed: heap exhaustion */
-			DEBUG_WARN("calloc: failed in %s\n", __func__);
-			continue;
-		}
-		memcpy(dp, initial_dp, sizeof(ADIv5_DP_t));
-		dp->idcode = idcode;
-		dp->targetid = dp_targetid;
-		adiv5_dp_init(dp);
-
+	if (scan_multidrop) {
+		memcpy(&multidrop_bus, initial_dp, sizeof(multidrop_bus));
+		multidrop_bus_valid = true;
 	}
+	swdp_scan_dps(initial_dp, target_id, idcode, scan_multidrop);
 	return target_list?1:0;
 }
 
+/* Add the DPs of another multi-drop part on the bus of the last scan.
+ * Targets found before are kept, so any of them can be attached without
+ * a rescan.  The GDB server still serves one connection, so only one of
+ * them is attached at a time.
+ * Returns the number of DPs found, or -1 if the last scan left no
+ * multi-drop bus to add to.  That is the case for probes that scan
+ * outside of adiv5_swdp_scan (J-Link, ST-Link), CMSIS-DAP without
+ * DAP_SWD_Sequence, and DPs before DPv2. */
+int adiv5_swdp_scan_more(uint32_t targetid)
+{
+	if (!multidrop_bus_valid || !targetid)
+		return -1;
+	return swdp_scan_dps(&multidrop_bus, targetid, 0, true);
+}
+
 uint32_t firmware_swdp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
 	if (addr & ADIV5_APnDP) {
@@ -192,6 +251,7 @@ uint32_t firmware_swdp_read(ADIv5_DP_t *dp, uint16_t addr)
 		/* On protocoll error target gets deselected.
 		 * With DP Change, another target needs selection.
 		 * => Reselect with right target! */
+		selected_targetid = dp->targetid;
 		dp_line_reset(dp);
 		dp->dp_low_write(dp, ADIV5_DP_TARGETSEL, dp->targetid);
 		dp->dp_read(dp, ADIV5_DP_IDCODE);
@@ -228,6 +288,10 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 	if ((addr & ADIV5_APnDP) && dp->fault)
 		return 0;
 
+	/* Several DPs of a multi-drop bus may be in use, e.g. both
+	 * RP2040 cores */
+	dp_select(dp);
+
 	platform_timeout_set(&timeout, 250);
 	do {
 		dp->seq_out(request, 8);
@@ -273,6 +337,42 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 	return response;
 }
 
+/* Write a run of values to one AP register, with ORUNDETECT set by the
+ * caller.  The ACKs are clocked in but not acted on, every transaction
+ * gets its data phase as ORUNDETECT requires, and transactions follow
+ * each other without idle cycles.  A WAIT on any of them leaves
+ * STICKYORUN set in CTRL/STAT and every later transaction is ignored.
+ */
+bool firmware_swdp_ap_write_stream(ADIv5_DP_t *dp, uint16_t addr,
+                                   const uint32_t *data, size_t count)
+{
+	if (dp->fault)
+		return false;
+
+	uint32_t request = make_packet_request(ADIV5_LOW_WRITE, addr);
+	bool acked = true;
+	for (size_t i = 0; i < count; i++) {
+		dp->seq_out(request, 8);
+		if (dp->seq_in(3) != SWDP_ACK_OK)
+			acked = false;
+		dp->seq_out_parity(data[i], 32);
+	}
+	dp->seq_out(0, 8);
+	return acked;
+}
+
+/* Line reset and reselect, as after a protocol error */
+void firmware_swdp_resync(ADIv5_DP_t *dp)
+{
+	dp_line_reset(dp);
+	if (((dp->idcode & ADIV5_DP_VERSION_MASK) == ADIV5_DPv2) &&
+	    dp->dp_low_write) {
+		selected_targetid = dp->targetid;
+		dp->dp_low_write(dp, ADIV5_DP_TARGETSEL, dp->targetid);
+	}
+	dp->dp_read(dp, ADIV5_DP_IDCODE);
+}
+
 void firmware_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
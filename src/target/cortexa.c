@@ -50,6 +50,7 @@ static ssize_t cortexa_reg_write(target *t, int reg, const void *data, size_t ma
 static void cortexa_reset(target *t);
 static enum target_halt_reason cortexa_halt_poll(target *t, target_addr *watch);
 static void cortexa_halt_request(target *t);
+static void cortexa_restart_pending(target *t);
 
 static int cortexa_breakwatch_set(target *t, struct breakwatch *);
 static int cortexa_breakwatch_clear(target *t, struct breakwatch *);
@@ -58,17 +59,25 @@ static uint32_t bp_bas(uint32_t addr, uint8_t len);
 static void apb_write(target *t, uint16_t reg, uint32_t val);
 static uint32_t apb_read(target *t, uint16_t reg);
 static void write_gpreg(target *t, uint8_t regno, uint32_t val);
+static void cortexa_regs_fetch(target *t);
 static uint32_t read_gpreg(target *t, uint8_t regno);
 
 struct cortexa_priv {
 	uint32_t base;
 	ADIv5_AP_t *apb;
+	ADIv5_AP_t *ahb; /* System bus AP for memory access, if any */
+	uint32_t cti; /* Cross trigger interface base, 0 if none */
+	target *leader; /* First core of the cluster, shown as GDB thread 1 */
+	uint32_t sctlr;
 	struct {
 		uint32_t r[16];
 		uint32_t cpsr;
 		uint32_t fpscr;
 		uint64_t d[16];
 	} reg_cache;
+	bool reg_cache_valid;
+	bool halted;
+	bool restart_pending;
 	unsigned hw_breakpoint_max;
 	uint16_t hw_breakpoint_mask;
 	uint32_t bcr0;
@@ -98,6 +107,7 @@ struct cortexa_priv {
 #define DBGDSCR_SDABORT_L        (1 << 6)
 #define DBGDSCR_MOE_MASK         (0xf << 2)
 #define DBGDSCR_MOE_HALT_REQ     (0x0 << 2)
+#define DBGDSCR_MOE_EXT_DBGRQ    (0x4 << 2)
 #define DBGDSCR_RESTARTED        (1 << 1)
 #define DBGDSCR_HALTED           (1 << 0)
 
@@ -116,6 +126,28 @@ struct cortexa_priv {
 #define DBGBCR_BAS_HIGH_HW       (0xc << 5)
 #define DBGBCR_EN                (1 << 0)
 
+/* Cross trigger interface, byte offsets.  Found at cluster base + 0x8000
+ * with one 4K page per core on Cortex-A5/A7/A9 (core debug is at 8K
+ * spacing). */
+#define CTI_DEBUG_OFFSET         0x8000
+#define CTI_PARTNO               0x906
+#define CTI_CONTROL              0x000
+#define CTI_CONTROL_GLBEN        (1 << 0)
+#define CTI_INTACK               0x010
+#define CTI_APPPULSE             0x01c
+#define CTI_INEN(n)              (0x020 + 4*(n))
+#define CTI_OUTEN(n)             (0x0a0 + 4*(n))
+#define CTI_GATE                 0x140
+#define CTI_LAR                  0xfb0
+#define CTI_LAR_KEY              0xc5acce55
+/* Trigger connections of the core */
+#define CTI_TRIGIN_DBGTRIGGER    0
+#define CTI_TRIGOUT_EDBGRQ       0
+#define CTI_TRIGOUT_DBGRESTART   7
+/* Channels used for cross halting and restarting */
+#define CTI_CHAN_HALT            (1 << 0)
+#define CTI_CHAN_RESTART         (1 << 1)
+
 /* Instruction encodings for accessing the coprocessor interface */
 #define MCR 0xee000010
 #define MRC 0xee100010
@@ -131,6 +163,11 @@ struct cortexa_priv {
 #define PAR         CPREG(15, 0, 0, 7, 4, 0)
 #define ATS1CPR     CPREG(15, 0, 0, 7, 8, 0)
 
+/* System control register CP15 */
+#define SCTLR       CPREG(15, 0, 0, 1, 0, 0)
+#define SCTLR_M     (1 << 0)
+#define SCTLR_C     (1 << 2)
+
 /* Cache management registers CP15 */
 #define ICIALLU     CPREG(15, 0, 0, 7, 5, 0)
 #define DCCIMVAC    CPREG(15, 0, 0, 7, 14, 1)
@@ -204,6 +241,41 @@ static uint32_t apb_read(target *t, uint16_t reg)
 	return adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
 }
 
+static void cti_write(target *t, uint16_t reg, uint32_t val)
+{
+	struct cortexa_priv *priv = t->priv;
+	ADIv5_AP_t *ap = priv->apb;
+	adiv5_ap_write(ap, ADIV5_AP_TAR, priv->cti + reg);
+	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, val);
+}
+
+/* Read count words from one APB register, with TAR set up only once
+ * and the AP reads posted back to back */
+static void apb_read_repeat(target *t, uint16_t reg, uint32_t *dest, size_t count)
+{
+	struct cortexa_priv *priv = t->priv;
+	ADIv5_AP_t *ap = priv->apb;
+	if (!count)
+		return;
+	adiv5_ap_write(ap, ADIV5_AP_TAR, priv->base + 4*reg);
+	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	for (size_t i = 0; i < count - 1; i++)
+		dest[i] = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	dest[count - 1] = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+}
+
+/* Write count words to one APB register, with TAR set up only once */
+static void apb_write_repeat(target *t, uint16_t reg, const uint32_t *src, size_t count)
+{
+	struct cortexa_priv *priv = t->priv;
+	ADIv5_AP_t *ap = priv->apb;
+	if (!count)
+		return;
+	adiv5_ap_write(ap, ADIV5_AP_TAR, priv->base + 4*reg);
+	for (size_t i = 0; i < count; i++)
+		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, src[i]);
+}
+
 static uint32_t va_to_pa(target *t, uint32_t va)
 {
 	struct cortexa_priv *priv = t->priv;
@@ -240,8 +312,8 @@ static void cortexa_slow_mem_read(target *t, void *dest, target_addr src, size_t
 	 * ignored. */
 	apb_read(t, DBGDTRTX);
 
-	for (unsigned i = 0; i < words; i++)
-		dest32[i] = apb_read(t, DBGDTRTX);
+	/* Each read of DBGDTRTX reissues the load */
+	apb_read_repeat(t, DBGDTRTX, dest32, words);
 
 	memcpy(dest, (uint8_t*)dest32 + (src & 3), len);
 
@@ -298,8 +370,8 @@ static void cortexa_slow_mem_write(target *t, target_addr dest, const void *src,
 
 	apb_write(t, DBGITR, 0xeca05e01); /* stc 14, cr5, [r0], #4 */
 
-	for (; len; len -= 4)
-		apb_write(t, DBGDTRRX, *src32++);
+	/* Each write of DBGDTRRX reissues the store */
+	apb_write_repeat(t, DBGDTRRX, src32, len / 4);
 
 	/* Switch back to stalling DCC mode */
 	dbgdscr = (dbgdscr & ~DBGDSCR_EXTDCCMODE_MASK) | DBGDSCR_EXTDCCMODE_STALL;
@@ -312,6 +384,47 @@ static void cortexa_slow_mem_write(target *t, target_addr dest, const void *src,
 	}
 }
 
+/* The system bus AP bypasses the MMU and the caches, so it is only used
+ * while both are off, e.g. when loading images from a boot loader.
+ * SCTLR is only read while halted, so a running core uses DCC. */
+static bool cortexa_ahb_usable(target *t)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (!priv->ahb || !priv->halted)
+		return false;
+	cortexa_regs_fetch(t);
+	return !(priv->sctlr & (SCTLR_M | SCTLR_C));
+}
+
+static void cortexa_ahb_check_error(target *t)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (adiv5_dp_error(priv->ahb->dp))
+		priv->mmu_fault = true;
+}
+
+static void cortexa_mem_read(target *t, void *dest, target_addr src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (!cortexa_ahb_usable(t)) {
+		cortexa_slow_mem_read(t, dest, src, len);
+		return;
+	}
+	adiv5_mem_read(priv->ahb, dest, src, len);
+	cortexa_ahb_check_error(t);
+}
+
+static void cortexa_mem_write(target *t, target_addr dest, const void *src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	if (!cortexa_ahb_usable(t)) {
+		cortexa_slow_mem_write(t, dest, src, len);
+		return;
+	}
+	adiv5_mem_write(priv->ahb, dest, src, len);
+	cortexa_ahb_check_error(t);
+}
+
 static bool cortexa_check_error(target *t)
 {
 	struct cortexa_priv *priv = t->priv;
@@ -321,6 +434,77 @@ static bool cortexa_check_error(target *t)
 }
 
 
+static void cortexa_priv_free(void *priv)
+{
+	struct cortexa_priv *p = priv;
+	if (p->ahb)
+		adiv5_ap_unref(p->ahb);
+	free(priv);
+}
+
+/* Parts with a MEM-AP on the system bus of the Cortex-A cluster, found
+ * by the ROM table of the cores' APB-AP.  Nothing in the ROM table tells
+ * which MEM-AP that is, and others may belong to other cores, e.g. the
+ * AHB-AP of the Cortex-M4 on STM32MP15. */
+static const struct {
+	uint16_t designer;
+	uint16_t partno;
+	uint8_t apsel;
+} cortexa_sys_aps[] = {
+	{AP_DESIGNER_STM, 0x500, 0}, /* STM32MP15: AXI-AP */
+};
+
+static ADIv5_AP_t *cortexa_sys_ap(ADIv5_AP_t *apb)
+{
+	for (size_t i = 0; i < sizeof(cortexa_sys_aps) / sizeof(cortexa_sys_aps[0]); i++) {
+		if ((apb->ap_designer != cortexa_sys_aps[i].designer) ||
+		    (apb->ap_partno != cortexa_sys_aps[i].partno) ||
+		    (apb->apsel == cortexa_sys_aps[i].apsel))
+			continue;
+		uint8_t apsel = cortexa_sys_aps[i].apsel;
+#if PC_HOSTED == 1
+		if (apb->dp->ap_setup && !apb->dp->ap_setup(apsel))
+			return NULL;
+#endif
+		return adiv5_new_ap(apb->dp, apsel);
+	}
+	return NULL;
+}
+
+struct cortexa_cluster {
+	ADIv5_DP_t *dp;
+	target *leader;
+};
+
+/* Cores behind the same DP are grouped as threads of the first one */
+static void cortexa_find_leader(int i, target *t, void *context)
+{
+	(void)i;
+	struct cortexa_cluster *c = context;
+	if (c->leader || (t->driver != cortexa_driver_str))
+		return;
+	struct cortexa_priv *priv = t->priv;
+	if ((priv->leader == t) && (priv->apb->dp == c->dp))
+		c->leader = t;
+}
+
+/* Locate the CTI of a core from the debug base of the first core */
+static uint32_t cortexa_cti_find(ADIv5_AP_t *apb, uint32_t leader_base,
+                                 uint32_t debug_base)
+{
+	if ((debug_base < leader_base) || ((debug_base - leader_base) & 0x1fff))
+		return 0;
+	uint32_t core = (debug_base - leader_base) / 0x2000;
+	if (core > 3)
+		return 0;
+	uint32_t cti = leader_base + CTI_DEBUG_OFFSET + core * 0x1000;
+	uint64_t pidr = adiv5_ap_read_pidr(apb, cti);
+	if (((pidr & ~0x0fff00fffULL) != 0x4000bb000ULL) ||
+	    ((pidr & 0xfff) != CTI_PARTNO))
+		return 0;
+	return cti;
+}
+
 bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 {
 	target *t;
@@ -338,10 +522,18 @@ bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 	}
 
 	t->priv = priv;
-	t->priv_free = free;
+	t->priv_free = cortexa_priv_free;
 	priv->apb = apb;
-	t->mem_read = cortexa_slow_mem_read;
-	t->mem_write = cortexa_slow_mem_write;
+	priv->ahb = cortexa_sys_ap(apb);
+	if (priv->ahb) {
+		/* Fast memory access through the system bus */
+		DEBUG_INFO("Cortex-A: Memory access through AP %d when MMU and "
+		           "caches are off\n", priv->ahb->apsel);
+	}
+	/* Not known until halted */
+	priv->sctlr = SCTLR_M | SCTLR_C;
+	t->mem_read = cortexa_mem_read;
+	t->mem_write = cortexa_mem_write;
 
 	priv->base = debug_base;
 	/* Set up APB CSW, we won't touch this again */
@@ -367,11 +559,28 @@ bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 	t->halt_request = cortexa_halt_request;
 	t->halt_poll = cortexa_halt_poll;
 	t->halt_resume = cortexa_halt_resume;
+	t->threads_restart = cortexa_restart_pending;
 	t->regs_size = sizeof(priv->reg_cache);
 
 	t->breakwatch_set = cortexa_breakwatch_set;
 	t->breakwatch_clear = cortexa_breakwatch_clear;
 
+	/* SMP: further cores of a cluster become threads of the first one,
+	 * halted and restarted together through their CTIs when present */
+	struct cortexa_cluster cluster = { .dp = apb->dp };
+	target_foreach(cortexa_find_leader, &cluster);
+	if (cluster.leader) {
+		struct cortexa_priv *lpriv = cluster.leader->priv;
+		priv->leader = cluster.leader;
+		priv->cti = cortexa_cti_find(apb, lpriv->base, debug_base);
+		target_add_thread(cluster.leader, t);
+	} else {
+		priv->leader = t;
+		priv->cti = cortexa_cti_find(apb, debug_base, debug_base);
+	}
+	if (priv->cti)
+		DEBUG_INFO("Cortex-A: CTI at 0x%08" PRIx32 "\n", priv->cti);
+
 	return true;
 }
 
@@ -382,6 +591,22 @@ bool cortexa_attach(target *t)
 
 	/* Clear any pending fault condition */
 	target_check_error(t);
+	priv->halted = false;
+	priv->restart_pending = false;
+
+	if (priv->cti) {
+		/* A core entering debug state halts the others on the halt
+		 * channel, the restart channel is mapped when resuming */
+		cti_write(t, CTI_LAR, CTI_LAR_KEY);
+		cti_write(t, CTI_CONTROL, 0);
+		cti_write(t, CTI_INEN(CTI_TRIGIN_DBGTRIGGER), CTI_CHAN_HALT);
+		cti_write(t, CTI_OUTEN(CTI_TRIGOUT_EDBGRQ), CTI_CHAN_HALT);
+		cti_write(t, CTI_OUTEN(CTI_TRIGOUT_DBGRESTART), 0);
+		cti_write(t, CTI_GATE, CTI_CHAN_HALT | CTI_CHAN_RESTART);
+		cti_write(t, CTI_INTACK, (1 << CTI_TRIGOUT_EDBGRQ) |
+		                         (1 << CTI_TRIGOUT_DBGRESTART));
+		cti_write(t, CTI_CONTROL, CTI_CONTROL_GLBEN);
+	}
 
 	/* Enable halting debug mode */
 	uint32_t dbgdscr = apb_read(t, DBGDSCR);
@@ -418,8 +643,21 @@ void cortexa_detach(target *t)
 		apb_write(t, DBGBCR(i), 0);
 	}
 
+	if (priv->cti) {
+		cortexa_restart_pending(t);
+		cti_write(t, CTI_CONTROL, 0);
+		cti_write(t, CTI_INTACK, (1 << CTI_TRIGOUT_EDBGRQ) |
+		                         (1 << CTI_TRIGOUT_DBGRESTART));
+	}
+	if (!priv->halted) {
+		uint32_t dbgdscr = apb_read(t, DBGDSCR);
+		apb_write(t, DBGDSCR, dbgdscr & ~(DBGDSCR_HDBGEN | DBGDSCR_ITREN));
+		return;
+	}
+
 	/* Restore any clobbered registers */
-	cortexa_regs_write_internal(t);
+	if (priv->reg_cache_valid)
+		cortexa_regs_write_internal(t);
 	/* Invalidate cache */
 	apb_write(t, DBGITR, MCR | ICIALLU);
 
@@ -454,6 +692,8 @@ static uint32_t read_gpreg(target *t, uint8_t regno)
 
 static void write_gpreg(target *t, uint8_t regno, uint32_t val)
 {
+	/* The register is about to be clobbered, save it first */
+	cortexa_regs_fetch(t);
 	/* Write value to DCC channel */
 	apb_write(t, DBGDTRRX, val);
 	/* Run instruction to load register */
@@ -461,21 +701,34 @@ static void write_gpreg(target *t, uint8_t regno, uint32_t val)
 	apb_write(t, DBGITR, instr);
 }
 
+/* Registers are only read out of a halted core when first needed */
+static void cortexa_regs_fetch(target *t)
+{
+	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
+	if (priv->reg_cache_valid || !priv->halted)
+		return;
+	cortexa_regs_read_internal(t);
+	priv->reg_cache_valid = true;
+}
+
 static void cortexa_regs_read(target *t, void *data)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
+	cortexa_regs_fetch(t);
 	memcpy(data, &priv->reg_cache, t->regs_size);
 }
 
 static void cortexa_regs_write(target *t, const void *data)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
+	cortexa_regs_fetch(t);
 	memcpy(&priv->reg_cache, data, t->regs_size);
 }
 
 static ssize_t ptr_for_reg(target *t, int reg, void **r)
 {
 	struct cortexa_priv *priv = (struct cortexa_priv *)t->priv;
+	cortexa_regs_fetch(t);
 	switch (reg) {
 	case 0 ... 15:
 		*r = &priv->reg_cache.r[reg];
@@ -530,6 +783,9 @@ static void cortexa_regs_read_internal(target *t)
 	/* Read FPSCR */
 	apb_write(t, DBGITR, 0xeef10a10); /* vmrs r0, fpscr */
 	priv->reg_cache.fpscr = read_gpreg(t, 0);
+	/* Read SCTLR to know if the system bus AP can be used */
+	apb_write(t, DBGITR, MRC | SCTLR);
+	priv->sctlr = read_gpreg(t, 0);
 	/* Read out VFP registers */
 	for (int i = 0; i < 16; i++) {
 		/* Read D[i] to R0/R1 */
@@ -608,6 +864,7 @@ static void cortexa_halt_request(target *t)
 
 static enum target_halt_reason cortexa_halt_poll(target *t, target_addr *watch)
 {
+	struct cortexa_priv *priv = t->priv;
 	(void)watch; /* No watchpoint support yet */
 
 	volatile uint32_t dbgdscr = 0;
@@ -630,6 +887,12 @@ static enum target_halt_reason cortexa_halt_poll(target *t, target_addr *watch)
 	if (!(dbgdscr & DBGDSCR_HALTED)) /* Not halted */
 		return TARGET_HALT_RUNNING;
 
+	if (!priv->halted) {
+		/* Just halted, registers are read when first needed */
+		priv->halted = true;
+		priv->reg_cache_valid = false;
+	}
+
 	DEBUG_INFO("%s: DBGDSCR = 0x%08"PRIx32"\n", __func__, dbgdscr);
 	/* Reenable DBGITR */
 	dbgdscr |= DBGDSCR_ITREN;
@@ -639,22 +902,56 @@ static enum target_halt_reason cortexa_halt_poll(target *t, target_addr *watch)
 	enum target_halt_reason reason;
 	switch (dbgdscr & DBGDSCR_MOE_MASK) {
 	case DBGDSCR_MOE_HALT_REQ:
+	case DBGDSCR_MOE_EXT_DBGRQ: /* Also halted by another core's CTI */
 		reason = TARGET_HALT_REQUEST;
 		break;
 	default:
 		reason = TARGET_HALT_BREAKPOINT;
 	}
 
-	cortexa_regs_read_internal(t);
-
 	return reason;
 }
 
+/* Restart all cores of the cluster that are waiting on the CTI restart
+ * channel with a single pulse, so they leave debug state together */
+static void cortexa_restart_pending(target *t)
+{
+	struct cortexa_priv *priv = t->priv;
+	target *pulse = NULL;
+	for (target *thr = priv->leader; thr; thr = thr->next_thread) {
+		if (((struct cortexa_priv *)thr->priv)->restart_pending) {
+			pulse = thr;
+			break;
+		}
+	}
+	if (!pulse)
+		return;
+
+	cti_write(pulse, CTI_APPPULSE, CTI_CHAN_RESTART);
+
+	platform_timeout to;
+	platform_timeout_set(&to, 200);
+	for (target *thr = priv->leader; thr; thr = thr->next_thread) {
+		struct cortexa_priv *tpriv = thr->priv;
+		if (!tpriv->restart_pending)
+			continue;
+		uint32_t dbgdscr;
+		do {
+			dbgdscr = apb_read(thr, DBGDSCR);
+		} while (!(dbgdscr & DBGDSCR_RESTARTED) &&
+		         !platform_timeout_is_expired(&to));
+		cti_write(thr, CTI_OUTEN(CTI_TRIGOUT_DBGRESTART), 0);
+		cti_write(thr, CTI_INTACK, 1 << CTI_TRIGOUT_DBGRESTART);
+		tpriv->restart_pending = false;
+	}
+}
+
 void cortexa_halt_resume(target *t, bool step)
 {
 	struct cortexa_priv *priv = t->priv;
 	/* Set breakpoint comarator for single stepping if needed */
 	if (step) {
+		cortexa_regs_fetch(t);
 		uint32_t addr = priv->reg_cache.r[15];
 		uint32_t bas = bp_bas(addr, (priv->reg_cache.cpsr & CPSR_THUMB) ? 2 : 4);
 		DEBUG_INFO("step 0x%08"PRIx32"  %"PRIx32"\n", addr, bas);
@@ -667,8 +964,9 @@ void cortexa_halt_resume(target *t, bool step)
 		apb_write(t, DBGBCR(0), priv->bcr0);
 	}
 
-	/* Write back register cache */
-	cortexa_regs_write_internal(t);
+	/* Write back register cache, untouched if it was never read */
+	if (priv->reg_cache_valid)
+		cortexa_regs_write_internal(t);
 
 	apb_write(t, DBGITR, MCR | ICIALLU); /* invalidate cache */
 
@@ -690,6 +988,23 @@ void cortexa_halt_resume(target *t, bool step)
 	dbgdscr &= ~DBGDSCR_ITREN;
 	apb_write(t, DBGDSCR, dbgdscr);
 
+	priv->halted = false;
+	priv->reg_cache_valid = false;
+
+	if (priv->cti) {
+		/* Drop the cross halt request or the core halts again at once */
+		cti_write(t, CTI_INTACK, 1 << CTI_TRIGOUT_EDBGRQ);
+		if (!step && priv->leader->threads_resuming) {
+			/* Restarted along with the other resumed cores by
+			 * cortexa_restart_pending() */
+			apb_write(t, DBGDRCR, DBGDRCR_CSE);
+			cti_write(t, CTI_OUTEN(CTI_TRIGOUT_DBGRESTART),
+			          CTI_CHAN_RESTART);
+			priv->restart_pending = true;
+			return;
+		}
+	}
+
 	do {
 		apb_write(t, DBGDRCR, DBGDRCR_CSE | DBGDRCR_RRQ);
 		dbgdscr = apb_read(t, DBGDSCR);
@@ -917,8 +917,10 @@ static int cortexm_fault_unwind(target *t)
 	return 0;
 }
 
-int cortexm_run_stub(target *t, uint32_t loadaddr,
-                     uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+/* Load the registers for a stub at loadaddr and let it run.  Use
+ * cortexm_wait_stub() to collect the result. */
+int cortexm_start_stub(target *t, uint32_t loadaddr,
+                       uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
 {
 	uint32_t regs[t->regs_size / 4];
 
@@ -932,19 +934,23 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 	regs[19] = 0;
 
 	cortexm_regs_write(t, regs);
+	t->regs_cached = false;
 
 	if (target_check_error(t))
 		return -1;
 
 	/* Execute the stub */
-	enum target_halt_reason reason;
-#if defined(PLATFORM_HAS_DEBUG)
-	uint32_t arm_regs_start[t->regs_size];
-	target_regs_read(t, arm_regs_start);
-#endif
 	cortexm_halt_resume(t, 0);
+	return 0;
+}
+
+/* Wait up to timeout ms for a running stub to hit a breakpoint.
+ * Returns the breakpoint immediate, or a negative value on failure. */
+int cortexm_wait_stub(target *t, uint32_t timeout_ms)
+{
+	enum target_halt_reason reason;
 	platform_timeout timeout;
-	platform_timeout_set(&timeout, 5000);
+	platform_timeout_set(&timeout, timeout_ms);
 	do {
 		if (platform_timeout_is_expired(&timeout)) {
 			cortexm_halt_request(t);
@@ -953,8 +959,7 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 			uint32_t arm_regs[t->regs_size];
 			target_regs_read(t, arm_regs);
 			for (unsigned int i = 0; i < 20; i++) {
-				DEBUG_WARN("%2d: %08" PRIx32 ", %08" PRIx32 "\n",
-						   i, arm_regs_start[i], arm_regs[i]);
+				DEBUG_WARN("%2d: %08" PRIx32 "\n", i, arm_regs[i]);
 			}
 #endif
 			return -3;
@@ -976,6 +981,15 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 	return bkpt_instr & 0xff;
 }
 
+int cortexm_run_stub(target *t, uint32_t loadaddr,
+                     uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	if (cortexm_start_stub(t, loadaddr, r0, r1, r2, r3))
+		return -1;
+
+	return cortexm_wait_stub(t, 5000);
+}
+
 /* The following routines implement hardware breakpoints and watchpoints.
  * The Flash Patch and Breakpoint (FPB) and Data Watch and Trace (DWT)
  * systems are used. */
@@ -42,17 +42,32 @@
 #include "target_internal.h"
 #include "cortexm.h"
 
-#define SRAM_BASE		0x20000000
-#define STUB_BUFFER_BASE	ALIGN(SRAM_BASE + sizeof(efm32_flash_write_stub), 4)
-
 static int efm32_flash_erase(struct target_flash *t, target_addr addr, size_t len);
 static int efm32_flash_write(struct target_flash *f,
 			     target_addr dest, const void *src, size_t len);
+static int efm32_flash_done(struct target_flash *f);
 
 static const uint16_t efm32_flash_write_stub[] = {
 #include "flashstub/efm32.stub"
 };
 
+/* RAM layout while the stub runs: stub, control block, ring of buffers.
+ * See flashstub/efm32.s for the control block. */
+#define SRAM_BASE		0x20000000
+#define STUB_CTRL		ALIGN(SRAM_BASE + sizeof(efm32_flash_write_stub), 4)
+#define STUB_CTRL_HEAD		0x00
+#define STUB_CTRL_TAIL		0x04
+#define STUB_CTRL_STATUS	0x08
+#define STUB_CTRL_STOP		0x0c
+#define STUB_CTRL_RING		0x10
+#define STUB_DESC_SIZE		12
+#define STUB_DESC(n)		(STUB_CTRL + STUB_CTRL_RING + (n) * STUB_DESC_SIZE)
+#define STUB_MAX_BUFFERS	4
+#define STUB_BUFFER_BASE	STUB_DESC(STUB_MAX_BUFFERS)
+/* Preferred buffer size, if the RAM allows for two of them */
+#define STUB_BUFFER_SIZE	0x1000
+#define STUB_TIMEOUT		5000
+
 static bool efm32_cmd_erase_all(target *t, int argc, const char **argv);
 static bool efm32_cmd_serial(target *t, int argc, const char **argv);
 static bool efm32_cmd_efm_info(target *t, int argc, const char **argv);
@@ -539,7 +554,7 @@ static efm32_v2_di_miscchip_t efm32_v2_read_miscchip(target *t, uint8_t di_versi
 
 
 static void efm32_add_flash(target *t, target_addr addr, size_t length,
-			    size_t page_size)
+			    size_t page_size, size_t ram_size)
 {
 	struct target_flash *f = calloc(1, sizeof(*f));
 	if (!f) {			/* calloc failed: heap exhaustion */
@@ -552,7 +567,13 @@ static void efm32_add_flash(target *t, target_addr addr, size_t length,
 	f->blocksize = page_size;
 	f->erase = efm32_flash_erase;
 	f->write = efm32_flash_write;
+	f->done = efm32_flash_done;
+	f->erased = 0xff;
+	/* Hand the stub bigger buffers than a page where the RAM allows */
 	f->buf_size = page_size;
+	while ((f->buf_size < STUB_BUFFER_SIZE) &&
+	       (STUB_BUFFER_BASE + 4 * f->buf_size <= SRAM_BASE + ram_size))
+		f->buf_size *= 2;
 	target_add_flash(t, f);
 }
 
@@ -586,6 +607,12 @@ static efm32_device_t const * efm32_get_device(size_t index)
  */
 struct efm32_priv_s {
 	char efm32_variant_string[60];
+	uint32_t ram_size;
+	/* Flash programming stub state, shared by all flash regions */
+	bool stub_running;
+	uint32_t stub_head;	/* Buffers handed to the stub */
+	uint32_t stub_buffers;	/* Buffers in the ring */
+	size_t stub_buffer_size;
 };
 
 bool efm32_probe(target *t)
@@ -651,19 +678,78 @@ bool efm32_probe(target *t)
 	t->target_options |= CORTEXM_TOPT_INHIBIT_SRST;
 	t->driver = priv_storage->efm32_variant_string;
 	tc_printf(t, "flash size %d page size %d\n", flash_size, flash_page_size);
+	priv_storage->ram_size = ram_size;
 	target_add_ram (t, SRAM_BASE, ram_size);
-	efm32_add_flash(t, 0x00000000, flash_size, flash_page_size);
+	efm32_add_flash(t, 0x00000000, flash_size, flash_page_size, ram_size);
 	if (device->user_data_size) { /* optional User Data (UD) section */
-		efm32_add_flash(t, 0x0fe00000, device->user_data_size, flash_page_size);
+		efm32_add_flash(t, 0x0fe00000, device->user_data_size, flash_page_size,
+				ram_size);
 	}
 	if (device->bootloader_size) { /* optional Bootloader (BL) section */
-		efm32_add_flash(t, 0x0fe10000, device->bootloader_size, flash_page_size);
+		efm32_add_flash(t, 0x0fe10000, device->bootloader_size, flash_page_size,
+				ram_size);
 	}
 	target_add_commands(t, efm32_cmd_list, "EFM32");
 
 	return true;
 }
 
+/**
+ * Stop the flash programming stub once it has programmed all buffers
+ * handed to it
+ */
+static int efm32_flash_stub_stop(target *t)
+{
+	struct efm32_priv_s *priv = t->target_storage;
+
+	if (!priv->stub_running)
+		return 0;
+	priv->stub_running = false;
+
+	target_mem_write32(t, STUB_CTRL + STUB_CTRL_STOP, 1);
+	int ret = cortexm_wait_stub(t, STUB_TIMEOUT);
+	if (ret == 1) {
+		DEBUG_WARN("EFM32: Flash write failed MSC_STATUS=%08"PRIx32"\n",
+			   target_mem_read32(t, STUB_CTRL + STUB_CTRL_STATUS));
+	} else if (ret) {
+		DEBUG_WARN("EFM32: Flash stub error %d\n", ret);
+	}
+	return ret ? -1 : 0;
+}
+
+/**
+ * Load and start the flash programming stub with a ring of as many
+ * buffers as fit in RAM
+ */
+static int efm32_flash_stub_start(target *t, uint32_t msc, size_t buffer_size)
+{
+	struct efm32_priv_s *priv = t->target_storage;
+
+	priv->stub_buffers = (SRAM_BASE + priv->ram_size - STUB_BUFFER_BASE) /
+		buffer_size;
+	if (priv->stub_buffers > STUB_MAX_BUFFERS)
+		priv->stub_buffers = STUB_MAX_BUFFERS;
+	if (!priv->stub_buffers)
+		return -1;
+	priv->stub_buffer_size = buffer_size;
+	priv->stub_head = 0;
+
+	target_mem_write(t, SRAM_BASE, efm32_flash_write_stub,
+			 sizeof(efm32_flash_write_stub));
+	const uint32_t ctrl[4] = {0, 0, 0, 0};
+	target_mem_write(t, STUB_CTRL, ctrl, sizeof(ctrl));
+
+	/* Unlock and set WREN bit to enable MSC write functionality */
+	target_mem_write32(t, EFM32_MSC_LOCK(msc), EFM32_MSC_LOCK_LOCKKEY);
+	target_mem_write32(t, EFM32_MSC_WRITECTRL(msc), 1);
+
+	if (cortexm_start_stub(t, SRAM_BASE, STUB_CTRL, 0,
+			       STUB_DESC(priv->stub_buffers), msc))
+		return -1;
+	priv->stub_running = true;
+	return 0;
+}
+
 /**
  * Erase flash row by row
  */
@@ -676,6 +762,10 @@ static int efm32_flash_erase(struct target_flash *f, target_addr addr, size_t le
 	}
 	uint32_t msc = device->msc_addr;
 
+	/* The MSC can only do one thing at a time */
+	if (efm32_flash_stub_stop(t))
+		return -1;
+
 	/* Unlock */
 	target_mem_write32(t, EFM32_MSC_LOCK(msc), EFM32_MSC_LOCK_LOCKKEY);
 
@@ -707,31 +797,67 @@ static int efm32_flash_erase(struct target_flash *f, target_addr addr, size_t le
 }
 
 /**
- * Write flash page by page
+ * Hand a buffer to the flash programming stub, starting it for the
+ * first buffer of a session.  Returns once the data is in target RAM,
+ * not when it is programmed.
  */
 static int efm32_flash_write(struct target_flash *f,
 			     target_addr dest, const void *src, size_t len)
 {
-	(void)len;
 	target *t = f->t;
+	struct efm32_priv_s *priv = t->target_storage;
 	efm32_device_t const* device = efm32_get_device(t->driver[2] - 32);
 	if (device == NULL) {
 		return true;
 	}
-	/* Write flashloader */
-	target_mem_write(t, SRAM_BASE, efm32_flash_write_stub,
-			 sizeof(efm32_flash_write_stub));
-	/* Write Buffer */
-	target_mem_write(t, STUB_BUFFER_BASE, src, len);
-	/* Run flashloader */
-	int ret = cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, len,
-							   device->msc_addr);
+
+	if (priv->stub_running && (priv->stub_buffer_size != len)) {
+		if (efm32_flash_stub_stop(t))
+			return -1;
+	}
+	if (!priv->stub_running) {
+		if (efm32_flash_stub_start(t, device->msc_addr, len))
+			return -1;
+	}
+
+	/* Wait for a free buffer in the ring */
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, STUB_TIMEOUT);
+	while (priv->stub_head -
+	       target_mem_read32(t, STUB_CTRL + STUB_CTRL_TAIL) >=
+	       priv->stub_buffers) {
+		if (target_check_error(t) ||
+		    platform_timeout_is_expired(&timeout) ||
+		    (target_halt_poll(t, NULL) != TARGET_HALT_RUNNING)) {
+			efm32_flash_stub_stop(t);
+			return -1;
+		}
+	}
+
+	uint32_t n = priv->stub_head % priv->stub_buffers;
+	uint32_t buf = STUB_BUFFER_BASE + n * len;
+	const uint32_t desc[3] = {dest, buf, len / 4};
+	target_mem_write(t, buf, src, len);
+	target_mem_write(t, STUB_DESC(n), desc, sizeof(desc));
+	target_mem_write32(t, STUB_CTRL + STUB_CTRL_HEAD, ++priv->stub_head);
+	if (target_check_error(t))
+		return -1;
+	return 0;
+}
+
+static int efm32_flash_done(struct target_flash *f)
+{
+	target *t = f->t;
+	int ret = efm32_flash_stub_stop(t);
 
 #ifdef ENABLE_DEBUG
 	/* Check the MSC_IF */
-	uint32_t msc = device->msc_addr;
-	uint32_t msc_if = target_mem_read32(t, EFM32_MSC_IF(msc));
-	DEBUG_INFO("EFM32: Flash write done MSC_IF=%08"PRIx32"\n", msc_if);
+	efm32_device_t const* device = efm32_get_device(t->driver[2] - 32);
+	if (device) {
+		uint32_t msc = device->msc_addr;
+		uint32_t msc_if = target_mem_read32(t, EFM32_MSC_IF(msc));
+		DEBUG_INFO("EFM32: Flash write done MSC_IF=%08"PRIx32"\n", msc_if);
+	}
 #endif
 	return ret;
 }
@@ -0,0 +1,112 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ EFM32/EFR32 streaming flash programming stub.
+@
+@ The stub stays resident for a whole flash session and drains a ring
+@ of buffers into the MSC while the debugger fills the next ones.  The
+@ control block is
+@
+@	+0  head, buffers handed over, written by the debugger
+@	+4  tail, buffers programmed, written by the stub
+@	+8  status, MSC_STATUS error bits if programming failed
+@	+12 stop, set by the debugger to stop once tail reaches head
+@	+16 ring of descriptors: destination, source, number of words
+@
+@ The ring descriptors are used in order.  Only ARMv6-M instructions
+@ are used so the stub runs on the Cortex-M0+ parts.
+@
+@ The caller unlocks the MSC and sets WRITECTRL.WREN first.
+@
+@ r0: control block
+@ r2: end of the descriptor ring
+@ r3: MSC register base
+@
+@ Exits with bkpt 0 when stopped, bkpt 1 on a programming error.
+
+	.syntax unified
+	.thumb
+
+	.equ	CTRL_HEAD,		0
+	.equ	CTRL_TAIL,		4
+	.equ	CTRL_STATUS,		8
+	.equ	CTRL_STOP,		12
+	.equ	CTRL_RING,		16
+	.equ	DESC_SIZE,		12
+
+	.equ	MSC_WRITECMD,		0x0c
+	.equ	MSC_ADDRB,		0x10
+	.equ	MSC_WDATA,		0x18
+	.equ	MSC_STATUS,		0x1c
+	.equ	MSC_WRITECMD_LADDRIM,	(1 << 0)
+	.equ	MSC_WRITECMD_WRITEONCE,	(1 << 3)
+
+efm32_flash_stub:
+	cpsid	i
+	movs	r4, r0
+	adds	r4, #CTRL_RING
+next:
+	ldr	r5, [r0, #CTRL_TAIL]
+wait:
+	ldr	r6, [r0, #CTRL_HEAD]
+	cmp	r6, r5
+	bne	work
+	ldr	r6, [r0, #CTRL_STOP]
+	cmp	r6, #0
+	beq	wait
+	bkpt	#0
+work:
+	ldr	r7, [r4, #0]
+	ldr	r1, [r4, #4]
+	ldr	r6, [r4, #8]
+word:
+	str	r7, [r3, #MSC_ADDRB]
+	movs	r5, #MSC_WRITECMD_LADDRIM
+	str	r5, [r3, #MSC_WRITECMD]
+	@ LOCKED or INVADDR
+	ldr	r5, [r3, #MSC_STATUS]
+	lsls	r5, r5, #29
+	lsrs	r5, r5, #30
+	bne	error
+wdata:
+	@ Wait for WDATAREADY
+	ldr	r5, [r3, #MSC_STATUS]
+	lsls	r5, r5, #28
+	bpl	wdata
+	ldm	r1!, {r5}
+	str	r5, [r3, #MSC_WDATA]
+	movs	r5, #MSC_WRITECMD_WRITEONCE
+	str	r5, [r3, #MSC_WRITECMD]
+busy:
+	@ Wait for BUSY to clear
+	ldr	r5, [r3, #MSC_STATUS]
+	lsrs	r5, r5, #1
+	bcs	busy
+	adds	r7, #4
+	subs	r6, #1
+	bne	word
+	ldr	r5, [r0, #CTRL_TAIL]
+	adds	r5, #1
+	str	r5, [r0, #CTRL_TAIL]
+	adds	r4, #DESC_SIZE
+	cmp	r4, r2
+	bne	next
+	movs	r4, r0
+	adds	r4, #CTRL_RING
+	b	next
+error:
+	ldr	r5, [r3, #MSC_STATUS]
+	str	r5, [r0, #CTRL_STATUS]
+	bkpt	#1
@@ -0,0 +1,52 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ MSP432 flash ROM call trampoline.
+@
+@ Calls the FlashCtl ROM routines for a list of descriptors, so many
+@ sectors are erased or programmed in one run.  Each descriptor is
+@
+@	+0 source buffer, or 0 to erase the sector at the destination
+@	+4 destination address
+@	+8 number of bytes, 0 ends the list
+@
+@ The caller sets up the stack and removes the write protection.
+@
+@ r4: descriptor list
+@ r5: FlashCtl_programMemory
+@ r6: FlashCtl_eraseSector
+@
+@ Exits with bkpt 0 and r0 true if all calls succeeded, r0 false and
+@ r4 past the failed descriptor otherwise.
+
+	.syntax unified
+	.thumb
+
+msp432_flash_stub:
+	ldmia	r4!, {r0-r2}
+	cbz	r2, done
+	cbnz	r0, program
+	mov	r0, r1
+	blx	r6
+	b	check
+program:
+	blx	r5
+check:
+	cmp	r0, #0
+	bne	msp432_flash_stub
+	bkpt	#0
+done:
+	movs	r0, #1
+	bkpt	#0
@@ -0,0 +1,68 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ nRF51/nRF52 double buffered flash programming stub.
+@
+@ The stub stays resident for a whole flash session and alternates
+@ between two slots of a control block, so the debugger can upload the
+@ next buffer while the current one is programmed.  Each slot is
+@
+@	+0 destination address
+@	+4 number of words, written last by the debugger to hand the slot
+@	   over; cleared by the stub when the slot is programmed.
+@	   0xffffffff stops the stub.
+@	+8 source buffer address
+@
+@ The caller sets NVMC CONFIG to WEN before starting the stub.
+@
+@ r0: control block
+@ r3: address of NVMC READY
+@
+@ Exits with bkpt 0 when stopped.
+
+	.syntax unified
+	.thumb
+
+	.equ	SLOT_SIZE,	12
+
+nrf51_flash_stub:
+	cpsid	i
+	movs	r4, #0
+next:
+	adds	r5, r0, r4
+wait:
+	ldr	r6, [r5, #4]
+	cmp	r6, #0
+	beq	wait
+	adds	r2, r6, #1
+	beq	stop
+	ldr	r7, [r5, #0]
+	ldr	r1, [r5, #8]
+copy:
+	ldm	r1!, {r2}
+	str	r2, [r7]
+	adds	r7, #4
+ready:
+	ldr	r2, [r3]
+	cmp	r2, #0
+	beq	ready
+	subs	r6, #1
+	bne	copy
+	str	r6, [r5, #4]
+	movs	r2, #SLOT_SIZE
+	eors	r4, r2
+	b	next
+stop:
+	bkpt	#0
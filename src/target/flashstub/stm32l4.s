@@ -0,0 +1,67 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ STM32L4/G4/WB fast programming (FLASH_CR_FSTPG) stub.
+@
+@ In fast programming mode a whole row of double words must be written
+@ back to back, with no more than one double word programming time
+@ between two writes, or the row is aborted with MISSERR.  That is not
+@ achievable over SWD, so the row copy runs on the target.
+@
+@ r0: destination, row aligned
+@ r1: source buffer in SRAM
+@ r2: number of rows in bits 15:0, words per row in bits 31:16
+@ r3: address of FLASH_SR, FLASH_CR follows at offset 4
+@
+@ Exits with bkpt 0 on success, bkpt 1 if FLASH_SR reports an error.
+
+	.syntax unified
+	.thumb
+
+	.equ	FLASH_CR_FSTPG,		(1 << 18)
+	.equ	FLASH_SR_BSY,		(1 << 16)
+	.equ	FLASH_SR_ERROR_MASK,	0x03FA
+
+stm32l4_flash_fast_stub:
+	cpsid	i
+	ldr	r4, =FLASH_CR_FSTPG
+	str	r4, [r3, #4]
+	lsrs	r7, r2, #16
+	uxth	r2, r2
+row:
+	mov	r5, r7
+copy:
+	ldr	r6, [r1], #4
+	str	r6, [r0], #4
+	subs	r5, #1
+	bne	copy
+busy:
+	ldr	r6, [r3]
+	tst	r6, #FLASH_SR_BSY
+	bne	busy
+	ldr	r4, =FLASH_SR_ERROR_MASK
+	tst	r6, r4
+	bne	error
+	subs	r2, #1
+	bne	row
+	movs	r4, #0
+	str	r4, [r3, #4]
+	bkpt	#0
+error:
+	movs	r4, #0
+	str	r4, [r3, #4]
+	bkpt	#1
+
+	.ltorg
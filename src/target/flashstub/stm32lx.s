@@ -0,0 +1,73 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ STM32L0/L1 program flash stub, half page programming and page erase.
+@
+@ Half page programming (NVM_PECR_FPRG) requires the words of a half
+@ page to be written back to back, and the NVM raises FWWERR if the
+@ sequence is interrupted.  Page erase needs a wait on BSY between
+@ pages.  Both are done here so the debugger only has to poll once.
+@ Only ARMv6-M instructions are used so the stub runs on the L0.
+@
+@ The caller unlocks the NVM and sets PECR for the operation first.
+@
+@ r0: destination, half page (write) or page (erase) aligned
+@ r1: source buffer in SRAM, or 0 to erase
+@ r2: number of blocks in bits 15:0, words per block in bits 31:16
+@ r3: NVM register base
+@
+@ Exits with bkpt 0 on success, bkpt 1 if NVM_SR reports an error.
+
+	.syntax unified
+	.thumb
+
+	.equ	NVM_SR,			0x18
+	.equ	NVM_SR_BSY,		(1 << 0)
+	.equ	NVM_SR_ERROR_MASK,	0x00030700
+
+stm32lx_flash_stub:
+	cpsid	i
+	lsrs	r7, r2, #16
+	uxth	r2, r2
+	ldr	r4, =NVM_SR_ERROR_MASK
+	str	r4, [r3, #NVM_SR]
+block:
+	cmp	r1, #0
+	beq	erase
+	mov	r5, r7
+copy:
+	ldm	r1!, {r6}
+	stm	r0!, {r6}
+	subs	r5, #1
+	bne	copy
+	b	busy
+erase:
+	str	r1, [r0]
+	lsls	r5, r7, #2
+	adds	r0, r5
+busy:
+	ldr	r6, [r3, #NVM_SR]
+	movs	r5, #NVM_SR_BSY
+	tst	r6, r5
+	bne	busy
+	tst	r6, r4
+	bne	error
+	subs	r2, #1
+	bne	block
+	bkpt	#0
+error:
+	bkpt	#1
+
+	.ltorg
@@ -223,6 +223,83 @@ int jtag_scan(const uint8_t *irlens)
 	return jtag_dev_count;
 }
 
+/* Longest merged shift, longer ones are done in three parts */
+#define JTAG_MERGED_BYTES 64
+
+/* The devices not addressed are in BYPASS and get ones, this is the
+ * template for all of them, merged shifts copy the payload into it */
+static const uint8_t jtag_bypass_ones[JTAG_MERGED_BYTES] = {
+	[0 ... JTAG_MERGED_BYTES - 1] = 0xff
+};
+
+/* Copy ticks bits of src to dst starting at bit offset, a byte at a time */
+static void jtag_bits_insert(uint8_t *dst, int offset, const uint8_t *src,
+                             int ticks)
+{
+	int shift = offset % 8;
+	dst += offset / 8;
+	for (int i = 0; i < ticks; i += 8, dst++) {
+		int n = MIN(8, ticks - i);
+		uint16_t mask = ((1 << n) - 1) << shift;
+		uint16_t val = ((uint16_t)src[i / 8] << shift) & mask;
+		dst[0] = (dst[0] & ~mask) | val;
+		if (shift + n > 8)
+			dst[1] = (dst[1] & ~(mask >> 8)) | (val >> 8);
+	}
+}
+
+/* Copy ticks bits of src starting at bit offset to dst, a byte at a time */
+static void jtag_bits_extract(uint8_t *dst, const uint8_t *src, int offset,
+                              int ticks)
+{
+	int shift = offset % 8;
+	src += offset / 8;
+	for (int i = 0; i < ticks; i += 8, src++) {
+		int n = MIN(8, ticks - i);
+		uint16_t val = src[0] >> shift;
+		if (shift + n > 8)
+			val |= src[1] << (8 - shift);
+		*dst++ = val & ((1 << n) - 1);
+	}
+}
+
+/* Shift prescan, payload and postscan in a single sequence, the other
+ * devices get ones (BYPASS) from a template the payload is copied into.
+ * A device alone on the chain is shifted without any copy.
+ * The caller has already moved the TAP to Shift-IR/DR.
+ */
+static void jtag_dev_shift(jtag_proc_t *jp, int prescan, uint8_t *dout,
+                           const uint8_t *din, int ticks, int postscan)
+{
+	if (!prescan && !postscan) {
+		if (dout)
+			jp->jtagtap_tdi_tdo_seq(dout, 1, din, ticks);
+		else
+			jp->jtagtap_tdi_seq(1, din, ticks);
+		return;
+	}
+	int total = prescan + ticks + postscan;
+	if (total > JTAG_MERGED_BYTES * 8) {
+		jp->jtagtap_tdi_seq(0, jtag_bypass_ones, prescan);
+		if(dout)
+			jp->jtagtap_tdi_tdo_seq((void*)dout, postscan?0:1, (void*)din, ticks);
+		else
+			jp->jtagtap_tdi_seq(postscan?0:1, (void*)din, ticks);
+		jp->jtagtap_tdi_seq(1, jtag_bypass_ones, postscan);
+		return;
+	}
+	uint8_t tdi[JTAG_MERGED_BYTES];
+	uint8_t tdo[JTAG_MERGED_BYTES];
+	memcpy(tdi, jtag_bypass_ones, (total + 7) / 8);
+	jtag_bits_insert(tdi, prescan, din, ticks);
+	if (!dout) {
+		jp->jtagtap_tdi_seq(1, tdi, total);
+		return;
+	}
+	jp->jtagtap_tdi_tdo_seq(tdo, 1, tdi, total);
+	jtag_bits_extract(dout, tdo, prescan, ticks);
+}
+
 void jtag_dev_write_ir(jtag_proc_t *jp, uint8_t jd_index, uint32_t ir)
 {
 	jtag_dev_t *d = &jtag_devs[jd_index];
@@ -232,9 +309,8 @@ void jtag_dev_write_ir(jtag_proc_t *jp, uint8_t jd_index, uint32_t ir)
 	d->current_ir = ir;
 
 	jtagtap_shift_ir();
-	jp->jtagtap_tdi_seq(0, ones, d->ir_prescan);
-	jp->jtagtap_tdi_seq(d->ir_postscan?0:1, (void*)&ir, d->ir_len);
-	jp->jtagtap_tdi_seq(1, ones, d->ir_postscan);
+	jtag_dev_shift(jp, d->ir_prescan, NULL, (void*)&ir, d->ir_len,
+	               d->ir_postscan);
 	jtagtap_return_idle();
 }
 
@@ -242,12 +318,7 @@ void jtag_dev_shift_dr(jtag_proc_t *jp, uint8_t jd_index, uint8_t *dout, const u
 {
 	jtag_dev_t *d = &jtag_devs[jd_index];
 	jtagtap_shift_dr();
-	jp->jtagtap_tdi_seq(0, ones, d->dr_prescan);
-	if(dout)
-		jp->jtagtap_tdi_tdo_seq((void*)dout, d->dr_postscan?0:1, (void*)din, ticks);
-	else
-		jp->jtagtap_tdi_seq(d->dr_postscan?0:1, (void*)din, ticks);
-	jp->jtagtap_tdi_seq(1, ones, d->dr_postscan);
+	jtag_dev_shift(jp, d->dr_prescan, dout, din, ticks, d->dr_postscan);
 	jtagtap_return_idle();
 }
 
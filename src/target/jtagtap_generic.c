@@ -32,31 +32,42 @@ void jtagtap_tms_seq(uint32_t MS, int ticks)
 	}
 }
 
+/* All bits but the last are shifted a byte at a time with TMS low, so
+ * only the last bit needs the final_tms check. */
 void jtagtap_tdi_tdo_seq(uint8_t *DO, const uint8_t final_tms, const uint8_t *DI, int ticks)
 {
-	uint8_t index = 1;
-	while(ticks--) {
-		if(jtagtap_next(ticks?0:final_tms, *DI & index)) {
-			*DO |= index;
-		} else {
-			*DO &= ~index;
-		}
-		if(!(index <<= 1)) {
-			index = 1;
-			DI++; DO++;
-		}
+	if (ticks <= 0)
+		return;
+	for (int n = (ticks - 1) / 8; n > 0; n--) {
+		uint8_t data = *DI++;
+		uint8_t res = 0;
+		for (int i = 0; i < 8; i++, data >>= 1)
+			res |= jtagtap_next(0, data & 1) << i;
+		*DO++ = res;
 	}
+	int rest = (ticks - 1) % 8;
+	uint8_t data = *DI;
+	uint8_t res = 0;
+	for (int i = 0; i < rest; i++, data >>= 1)
+		res |= jtagtap_next(0, data & 1) << i;
+	res |= jtagtap_next(final_tms, data & 1) << rest;
+	/* Keep the bits of the last byte beyond the sequence */
+	uint8_t mask = (2 << rest) - 1;
+	*DO = (*DO & ~mask) | res;
 }
 
 void jtagtap_tdi_seq(const uint8_t final_tms, const uint8_t *DI, int ticks)
 {
-	uint8_t index = 1;
-	while(ticks--) {
-		jtagtap_next(ticks?0:final_tms, *DI & index);
-		if(!(index <<= 1)) {
-			index = 1;
-			DI++;
-		}
+	if (ticks <= 0)
+		return;
+	for (int n = (ticks - 1) / 8; n > 0; n--) {
+		uint8_t data = *DI++;
+		for (int i = 0; i < 8; i++, data >>= 1)
+			jtagtap_next(0, data & 1);
 	}
+	int rest = (ticks - 1) % 8;
+	uint8_t data = *DI;
+	for (int i = 0; i < rest; i++, data >>= 1)
+		jtagtap_next(0, data & 1);
+	jtagtap_next(final_tms, data & 1);
 }
-
@@ -31,6 +31,10 @@
  *
  * Extended with support for K64 family with info from K64P144M120SF5RM:
  * 		K64 Sub-Family Reference Manual, Rev. 2,
+ *
+ * Parts with FlexRAM use it as the section program buffer: a whole
+ * buffer of data is staged there and written by a single Program
+ * Section command instead of one FTFx command per long word or phrase.
  */
 
 #include "command.h"
@@ -56,12 +60,15 @@
 #define FTFA_FSTAT_FPVIOL   (1 << 4)
 #define FTFA_FSTAT_MGSTAT0  (1 << 0)
 
+#define FTFA_FCNFG_RAMRDY   (1 << 1)
+
 #define FTFA_CMD_CHECK_ERASE       0x01
 #define FTFA_CMD_PROGRAM_CHECK     0x02
 #define FTFA_CMD_READ_RESOURCE     0x03
 #define FTFA_CMD_PROGRAM_LONGWORD  0x06
 /* Part of the FTFE module for K64 */
 #define FTFE_CMD_PROGRAM_PHRASE    0x07
+#define FTFx_CMD_PROGRAM_SECTION   0x0B
 #define FTFA_CMD_ERASE_SECTOR      0x09
 #define FTFA_CMD_CHECK_ERASE_ALL   0x40
 #define FTFA_CMD_READ_ONCE         0x41
@@ -73,6 +80,10 @@
 /* 8 byte phrases need to be written to the k64 flash */
 #define K64_WRITE_LEN 8
 
+/* FlexRAM, when not used for EEPROM emulation, is the section program
+ * buffer */
+#define FLEXRAM_BASE 0x14000000
+
 static bool kinetis_cmd_unsafe(target *t, int argc, char *argv[]);
 
 const struct command_s kinetis_cmd_list[] = {
@@ -99,6 +110,10 @@ static int kl_gen_flash_done(struct target_flash *f);
 struct kinetis_flash {
 	struct target_flash f;
 	uint8_t write_len;
+	/* Size of the section program buffer, 0 if not available */
+	uint16_t section_len;
+	/* Program Section was refused in this flash session */
+	bool section_refused;
 };
 
 static void kl_gen_add_flash(target *t, uint32_t addr, size_t length,
@@ -124,6 +139,19 @@ static void kl_gen_add_flash(target *t, uint32_t addr, size_t length,
 	target_add_flash(t, f);
 }
 
+/* Enable section programming on all flash regions, staging data in a
+ * FlexRAM of size len. */
+static void kl_gen_set_section(target *t, size_t len)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write != kl_gen_flash_write)
+			continue;
+		struct kinetis_flash *kf = (struct kinetis_flash *)f;
+		kf->section_len = len;
+		f->buf_size = MIN(f->blocksize, len);
+	}
+}
+
 bool kinetis_probe(target *t)
 {
 	uint32_t sdid = target_mem_read32(t, SIM_SDID);
@@ -259,6 +287,7 @@ bool kinetis_probe(target *t)
 		target_add_ram(t, 0x20000000,  0x30000);
 		kl_gen_add_flash(t, 0, 0x80000, 0x1000, K64_WRITE_LEN);
 		kl_gen_add_flash(t, 0x80000, 0x80000, 0x1000, K64_WRITE_LEN);
+		kl_gen_set_section(t, 0x1000);
 		break;
 	case 0x000: /* Older K-series */
 		switch(sdid & 0xff0) {
@@ -324,6 +353,7 @@ bool kinetis_probe(target *t)
 		target_add_ram(t, 0x20000000, 0x00005800); /* SRAM_H, 22 KB */
 		kl_gen_add_flash(t, 0x00000000, 0x00040000, 0x800, K64_WRITE_LEN); /* P-Flash, 256 KB, 2 KB Sectors */
 		kl_gen_add_flash(t, 0x10000000, 0x00008000, 0x800, K64_WRITE_LEN); /* FlexNVM, 32 KB, 2 KB Sectors */
+		kl_gen_set_section(t, 0x800); /* FlexRAM, 2 KB */
 		break;
 		/* gen1 s32k14x */
 		{
@@ -362,6 +392,7 @@ do_common_s32k14x:
 
 		kl_gen_add_flash(t, 0x00000000, flash, 0x1000, K64_WRITE_LEN);	 /* P-Flash, 4 KB Sectors */
 		kl_gen_add_flash(t, 0x10000000, flexmem, 0x1000, K64_WRITE_LEN); /* FlexNVM, 4 KB Sectors */
+		kl_gen_set_section(t, 0x1000); /* FlexRAM, 4 KB */
 		break;
 		}
 	default:
@@ -429,6 +460,36 @@ static int kl_gen_flash_erase(struct target_flash *f, target_addr addr, size_t l
 #define FLASH_SECURITY_BYTE_ADDRESS 0x40C
 #define FLASH_SECURITY_BYTE_UNSECURED 0xFE
 
+/* Program *len bytes, staged in FlexRAM a section at a time. The count
+ * is in units of the flash write size. dest, src and len are advanced
+ * past the sections programmed, so a caller can carry on from there.
+ * Returns 0 when done, 1 on a flash error and -1 if the command was
+ * refused. */
+static int kl_gen_flash_write_section(struct target_flash *f,
+                                      target_addr *dest, const uint8_t **src,
+                                      size_t *len)
+{
+	struct kinetis_flash *kf = (struct kinetis_flash *)f;
+
+	while (*len) {
+		size_t chunk = MIN(*len, kf->section_len);
+		uint32_t count = (chunk / kf->write_len) << 16;
+
+		target_mem_write(f->t, FLEXRAM_BASE, *src, chunk);
+		if (!kl_gen_command(f->t, FTFx_CMD_PROGRAM_SECTION, *dest,
+		                    &count, 1)) {
+			/* A protection violation is an error whatever the
+			 * command, ACCERR means it is not available here */
+			uint8_t fstat = target_mem_read8(f->t, FTFA_FSTAT);
+			return (fstat & FTFA_FSTAT_FPVIOL) ? 1 : -1;
+		}
+		*len -= chunk;
+		*dest += chunk;
+		*src += chunk;
+	}
+	return 0;
+}
+
 static int kl_gen_flash_write(struct target_flash *f,
                               target_addr dest, const void *src, size_t len)
 {
@@ -450,8 +511,24 @@ static int kl_gen_flash_write(struct target_flash *f,
 		write_cmd = FTFA_CMD_PROGRAM_LONGWORD;
 	}
 
+	/* Program whole sections from FlexRAM if it is available as RAM.
+	 * It is not while it holds emulated EEPROM. */
+	if (kf->section_len && !kf->section_refused &&
+	    (target_mem_read8(f->t, FTFA_FCNFG) & FTFA_FCNFG_RAMRDY)) {
+		const uint8_t *data = src;
+		int ret = kl_gen_flash_write_section(f, &dest, &data, &len);
+		if (ret >= 0)
+			return ret;
+		src = data;
+		/* Carry on from the first section not programmed */
+		DEBUG_WARN("kinetis: Program Section refused, using %s writes\n",
+		           kf->write_len == K64_WRITE_LEN ? "phrase" : "longword");
+		kf->section_refused = true;
+	}
+
 	while (len) {
-		if (kl_gen_command(f->t, write_cmd, dest, src, 1)) {
+		if (kl_gen_command(f->t, write_cmd, dest, src,
+		                   kf->write_len / 4)) {
 			if (len > kf->write_len)
 				len -= kf->write_len;
 			else
@@ -469,6 +546,9 @@ static int kl_gen_flash_done(struct target_flash *f)
 {
 	struct kinetis_flash *kf = (struct kinetis_flash *)f;
 
+	/* Try section programming again in the next session */
+	kf->section_refused = false;
+
 	if (f->t->unsafe_enabled)
 		return 0;
 
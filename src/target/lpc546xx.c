@@ -185,6 +185,8 @@ static bool lpc546xx_cmd_erase_mass(target *t, int argc, const char *argv[])
 
 	int result = lpc546xx_flash_erase(t->flash, t->flash->start,
 					  t->flash->length);
+	/* Not part of a GDB flash sequence, restore the IAP state now */
+	lpc_iap_session_end((struct lpc_flash *)t->flash);
 
 	if (result != 0) {
 		tc_printf(t, "Error erasing flash: %d\n", result);
@@ -202,6 +204,7 @@ static bool lpc546xx_cmd_erase_sector(target *t, int argc, const char *argv[])
 		uint32_t sector_addr = strtoul(argv[1], NULL, 0);
 		sector_addr *= t->flash->blocksize;
 		int retval = lpc546xx_flash_erase(t->flash, sector_addr, 1);
+		lpc_iap_session_end((struct lpc_flash *)t->flash);
 		return retval == 0;
 	}
 	return -1;
@@ -273,6 +276,7 @@ static bool lpc546xx_cmd_write_sector(target *t, int argc, const char *argv[])
 
 		int retval = lpc546xx_flash_erase(t->flash, sector_addr, 1);
 		if (retval != 0) {
+			lpc_iap_session_end((struct lpc_flash *)t->flash);
 			return retval;
 		}
 
@@ -283,6 +287,7 @@ static bool lpc546xx_cmd_write_sector(target *t, int argc, const char *argv[])
 
 		retval = lpc_flash_write_magic_vect(t->flash, sector_addr, buf,
 						    sector_size);
+		lpc_iap_session_end((struct lpc_flash *)t->flash);
 
 		free(buf);
 
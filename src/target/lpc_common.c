@@ -24,6 +24,9 @@
 
 #include <stdarg.h>
 
+/* IAP parameter block in target RAM.  A single call returns to the
+ * breakpoint in opcode.  A combined call runs the trampoline, which
+ * issues command and, if that succeeds, command2. */
 struct flash_param {
 	uint16_t opcode;
 	uint16_t pad0;
@@ -31,8 +34,32 @@ struct flash_param {
 	uint32_t words[4];
 	uint32_t status;
 	uint32_t result[4];
+	uint32_t command2;
+	uint32_t words2[4];
+	uint16_t trampoline[10];
 } __attribute__((aligned(4)));
 
+/* r4: first command, r5: second command, r6: IAP entry, r7: status */
+static const uint16_t lpc_iap_trampoline[10] = {
+	0x4620, /* mov  r0, r4 */
+	0x4639, /* mov  r1, r7 */
+	0x47B0, /* blx  r6 */
+	0x6838, /* ldr  r0, [r7] */
+	0x2800, /* cmp  r0, #0 */
+	0xD102, /* bne  done */
+	0x4628, /* mov  r0, r5 */
+	0x4639, /* mov  r1, r7 */
+	0x47B0, /* blx  r6 */
+	0xBE00, /* done: bkpt #0 */
+};
+
+/* Target state saved while a series of IAP calls is made */
+struct iap_session {
+	struct flash_param backup_param;
+	struct flash_param param; /* Copy of the parameters in target RAM */
+	uint32_t backup_regs[];
+};
+
 char *iap_error[] = {
 	"CMD_SUCCESS",
 	"Invalid command",
@@ -72,6 +99,7 @@ char *iap_error[] = {
 
 static int lpc_flash_write(struct target_flash *tf,
 						   target_addr dest, const void *src, size_t len);
+static int lpc_flash_done(struct target_flash *tf);
 
 struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length)
 {
@@ -88,61 +116,134 @@ struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length)
 	f->length = length;
 	f->erase = lpc_flash_erase;
 	f->write = lpc_flash_write;
+	f->done = lpc_flash_done;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 	return lf;
 }
 
-enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...)
+/* Restore the IAP RAM and registers saved by lpc_iap_session_start() */
+void lpc_iap_session_end(struct lpc_flash *f)
 {
+	struct iap_session *session = f->iap_session;
 	target *t = f->f.t;
-	struct flash_param param = {
-		.opcode = ARM_THUMB_BREAKPOINT,
-		.command = cmd,
-	};
 
-	/* Pet WDT before each IAP call, if it is on */
-	if (f->wdt_kick)
-		f->wdt_kick(t);
+	if (!session)
+		return;
+	target_mem_write(t, f->iap_ram, &session->backup_param,
+	                 sizeof(session->backup_param));
+	target_regs_write(t, session->backup_regs);
+	free(session);
+	f->iap_session = NULL;
+}
 
-	/* save IAP RAM to restore after IAP call */
-	struct flash_param backup_param;
-	target_mem_read(t, &backup_param, f->iap_ram, sizeof(backup_param));
+/* Save the IAP RAM and the registers once for a series of IAP calls,
+ * until lpc_iap_session_end().  Returns false if out of memory. */
+bool lpc_iap_session_start(struct lpc_flash *f)
+{
+	target *t = f->f.t;
 
-	/* save registers to restore after IAP call */
-	uint32_t backup_regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, backup_regs);
+	if (f->iap_session)
+		return true;
 
-	/* fill out the remainder of the parameters */
-	va_list ap;
-	va_start(ap, cmd);
-	for (int i = 0; i < 4; i++)
-		param.words[i] = va_arg(ap, uint32_t);
-	va_end(ap);
+	/* Only one session per target, the saved state must be the
+	 * user's and not that of another session.  LPC flashes may
+	 * replace write, e.g. with lpc_flash_write_magic_vect(), but
+	 * all of them keep lpc_flash_done(). */
+	for (struct target_flash *tf = t->flash; tf; tf = tf->next)
+		if (tf->done == lpc_flash_done)
+			lpc_iap_session_end((struct lpc_flash *)tf);
+
+	struct iap_session *session = calloc(1, sizeof(*session) + t->regs_size);
+	if (!session) {			/* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	target_mem_read(t, &session->backup_param, f->iap_ram,
+	                sizeof(session->backup_param));
+	target_regs_read(t, session->backup_regs);
+
+	session->param.opcode = ARM_THUMB_BREAKPOINT;
+	memcpy(session->param.trampoline, lpc_iap_trampoline,
+	       sizeof(lpc_iap_trampoline));
+	target_mem_write(t, f->iap_ram, &session->param, sizeof(session->param));
+	f->iap_session = session;
+	return true;
+}
+
+/* Write the parts of param that differ from the copy in target RAM */
+static void lpc_iap_param_update(struct lpc_flash *f,
+                                 const struct flash_param *param)
+{
+	struct iap_session *session = f->iap_session;
+	const uint8_t *new = (const uint8_t *)param;
+	const uint8_t *old = (const uint8_t *)&session->param;
+	size_t start = 0;
+	size_t end = sizeof(*param);
+
+	while ((start < end) && (new[start] == old[start]))
+		start++;
+	while ((end > start) && (new[end - 1] == old[end - 1]))
+		end--;
+	if (start == end)
+		return;
+	start &= ~3;
+	end = ALIGN(end, 4);
+	target_mem_write(f->f.t, f->iap_ram + start, new + start, end - start);
+	memcpy(&session->param, param, sizeof(*param));
+}
+
+/* Run IAP commands in the current session.  With cmd2 set, both run
+ * in one halt/resume cycle and cmd2 only if cmd succeeds. */
+static enum iap_status lpc_iap_run(struct lpc_flash *f, void *result,
+                                   enum iap_cmd cmd, const uint32_t *words,
+                                   enum iap_cmd cmd2, const uint32_t *words2)
+{
+	target *t = f->f.t;
+	struct iap_session *session = f->iap_session;
+	struct flash_param param = session->param;
 
-	/* copy the structure to RAM */
-	target_mem_write(t, f->iap_ram, &param, sizeof(param));
+	/* Pet WDT before each IAP call, if it is on */
+	if (f->wdt_kick)
+		f->wdt_kick(t);
+
+	param.command = cmd;
+	memcpy(param.words, words, sizeof(param.words));
+	if (cmd2) {
+		param.command2 = cmd2;
+		memcpy(param.words2, words2, sizeof(param.words2));
+	}
+	lpc_iap_param_update(f, &param);
 
 	/* set up for the call to the IAP ROM */
 	uint32_t regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, regs);
-	regs[0] = f->iap_ram + offsetof(struct flash_param, command);
-	regs[1] = f->iap_ram + offsetof(struct flash_param, status);
+	memcpy(regs, session->backup_regs, t->regs_size);
 	regs[REG_MSP] = f->iap_msp;
-	regs[REG_LR] = f->iap_ram | 1;
-	regs[REG_PC] = f->iap_entry;
+	if (cmd2) {
+		regs[4] = f->iap_ram + offsetof(struct flash_param, command);
+		regs[5] = f->iap_ram + offsetof(struct flash_param, command2);
+		regs[6] = f->iap_entry;
+		regs[7] = f->iap_ram + offsetof(struct flash_param, status);
+		regs[REG_PC] = f->iap_ram +
+			offsetof(struct flash_param, trampoline);
+	} else {
+		regs[0] = f->iap_ram + offsetof(struct flash_param, command);
+		regs[1] = f->iap_ram + offsetof(struct flash_param, status);
+		regs[REG_LR] = f->iap_ram | 1;
+		regs[REG_PC] = f->iap_entry;
+	}
 	target_regs_write(t, regs);
 
 	/* start the target and wait for it to halt again */
 	target_halt_resume(t, false);
 	while (!target_halt_poll(t, NULL));
 
-	/* copy back just the parameters structure */
-	target_mem_read(t, &param, f->iap_ram, sizeof(param));
-
-	/* restore the original data in RAM and registers */
-	target_mem_write(t, f->iap_ram, &backup_param, sizeof(param));
-	target_regs_write(t, backup_regs);
+	/* copy back just the status and results */
+	target_mem_read(t, &param.status, f->iap_ram +
+	                offsetof(struct flash_param, status),
+	                sizeof(param.status) + sizeof(param.result));
+	memcpy(&session->param.status, &param.status,
+	       sizeof(param.status) + sizeof(param.result));
 
 	/* if the user expected a result, set the result (16 bytes). */
 	if (result != NULL)
@@ -162,6 +263,30 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd
 	return param.status;
 }
 
+/* Issue one IAP command.  Outside a session the IAP RAM and registers
+ * are saved and restored around the call. */
+enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...)
+{
+	uint32_t words[4];
+
+	/* fill out the remainder of the parameters */
+	va_list ap;
+	va_start(ap, cmd);
+	for (int i = 0; i < 4; i++)
+		words[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+
+	bool in_session = f->iap_session;
+	if (!in_session && !lpc_iap_session_start(f))
+		return IAP_STATUS_INVALID_COMMAND;
+
+	enum iap_status status = lpc_iap_run(f, result, cmd, words, 0, NULL);
+
+	if (!in_session)
+		lpc_iap_session_end(f);
+	return status;
+}
+
 static uint8_t lpc_sector_for_addr(struct lpc_flash *f, uint32_t addr)
 {
 	return f->base_sector + (addr - f->f.start) / f->f.blocksize;
@@ -170,9 +295,9 @@ static uint8_t lpc_sector_for_addr(struct lpc_flash *f, uint32_t addr)
 #define LPX80X_SECTOR_SIZE 0x400
 #define LPX80X_PAGE_SIZE    0x40
 
-int lpc_flash_erase(struct target_flash *tf, target_addr addr, size_t len)
+static int lpc_flash_erase_sectors(struct lpc_flash *f, target_addr addr, size_t len)
 {
-	struct lpc_flash *f = (struct lpc_flash *)tf;
+	struct target_flash *tf = &f->f;
 	uint32_t start = lpc_sector_for_addr(f, addr);
 	uint32_t end = lpc_sector_for_addr(f, addr + len - 1);
 	uint32_t last_full_sector = end;
@@ -206,24 +331,43 @@ int lpc_flash_erase(struct target_flash *tf, target_addr addr, size_t len)
 	return 0;
 }
 
-static int lpc_flash_write(struct target_flash *tf,
-                    target_addr dest, const void *src, size_t len)
+int lpc_flash_erase(struct target_flash *tf, target_addr addr, size_t len)
 {
 	struct lpc_flash *f = (struct lpc_flash *)tf;
-	/* prepare... */
-	uint32_t sector = lpc_sector_for_addr(f, dest);
-	if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, sector, sector, f->bank)) {
-		DEBUG_WARN("Prepare failed\n");
+
+	/* Keep the IAP state until done, or until something fails */
+	if (!lpc_iap_session_start(f))
 		return -1;
-	}
+	int ret = lpc_flash_erase_sectors(f, addr, len);
+	if (ret)
+		lpc_iap_session_end(f);
+	return ret;
+}
+
+static int lpc_flash_write_sector(struct lpc_flash *f,
+                                  target_addr dest, const void *src, size_t len)
+{
+	struct target_flash *tf = &f->f;
+	uint32_t sector = lpc_sector_for_addr(f, dest);
+
+	/* Write payload to target ram */
 	uint32_t bufaddr = ALIGN(f->iap_ram + sizeof(struct flash_param), 4);
 	target_mem_write(f->f.t, bufaddr, src, len);
 	/* Only LPC80x has reserved pages!*/
 	if ((!f->reserved_pages) || ((dest + len) <= (tf->length - len))) {
-		/* Write payload to target ram */
-		/* set the destination address and program */
-		if (lpc_iap_call(f, NULL, IAP_CMD_PROGRAM, dest, bufaddr, len, CPU_CLK_KHZ))
+		/* prepare and program in one go */
+		const uint32_t prepare[4] = {sector, sector, f->bank, 0};
+		const uint32_t program[4] = {dest, bufaddr, len, CPU_CLK_KHZ};
+		switch (lpc_iap_run(f, NULL, IAP_CMD_PREPARE, prepare,
+		                    IAP_CMD_PROGRAM, program)) {
+		case IAP_STATUS_CMD_SUCCESS:
+			break;
+		case IAP_STATUS_INVALID_SECTOR:
+			DEBUG_WARN("Prepare failed\n");
+			return -1;
+		default:
 			return -2;
+		}
 	} else {
 		/* On LPC80x, write top sector in pages.
 		 * Silently ignore write to the 2 reserved pages at top!*/
@@ -244,6 +388,26 @@ static int lpc_flash_write(struct target_flash *tf,
 	return 0;
 }
 
+static int lpc_flash_write(struct target_flash *tf,
+                    target_addr dest, const void *src, size_t len)
+{
+	struct lpc_flash *f = (struct lpc_flash *)tf;
+
+	/* Keep the IAP state until done, or until something fails */
+	if (!lpc_iap_session_start(f))
+		return -1;
+	int ret = lpc_flash_write_sector(f, dest, src, len);
+	if (ret)
+		lpc_iap_session_end(f);
+	return ret;
+}
+
+static int lpc_flash_done(struct target_flash *tf)
+{
+	lpc_iap_session_end((struct lpc_flash *)tf);
+	return 0;
+}
+
 int lpc_flash_write_magic_vect(struct target_flash *f,
                                target_addr dest, const void *src, size_t len)
 {
@@ -78,10 +78,14 @@ struct lpc_flash {
 	uint32_t iap_entry;
 	uint32_t iap_ram;
 	uint32_t iap_msp;
+	/* Saved target state while a series of IAP calls is made */
+	struct iap_session *iap_session;
 };
 
 struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length);
 enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...);
+bool lpc_iap_session_start(struct lpc_flash *f);
+void lpc_iap_session_end(struct lpc_flash *f);
 int lpc_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 int lpc_flash_write_magic_vect(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
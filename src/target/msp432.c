@@ -88,11 +88,14 @@
 #define P401M_SRAM_SIZE 0x00008000u /* Size of SRAM, M: 32KB */
 #define P401R_SRAM_SIZE 0x00010000u /* Size of SRAM, R: 64KB */
 
-/* Flash write buffer and stack */
+/* Flash write buffers, stack and ROM call trampoline */
 #define SRAM_STACK_OFFSET 0x00000200u /* A bit less than 512 stack room */
 #define SRAM_STACK_PTR (SRAM_BASE + SRAM_STACK_OFFSET)
-#define SRAM_WRITE_BUFFER SRAM_STACK_PTR /* Buffer right above stack */
+#define SRAM_TRAMPOLINE (SRAM_CODE_BASE + SRAM_STACK_OFFSET) /* Above stack */
+#define SRAM_DESC_LIST (SRAM_BASE + 0x00000240u) /* Above trampoline */
+#define SRAM_WRITE_BUFFER (SRAM_BASE + 0x00000400u) /* Above descriptors */
 #define SRAM_WRITE_BUF_SIZE 0x00000400u  /* Write 1024 bytes at a tima */
+#define QUEUE_LEN 16 /* Buffers or sectors per trampoline run */
 
 /* Watchdog */
 #define WDT_A_WTDCTL 0x4000480Cu /* Control register for watchdog */
@@ -107,11 +110,32 @@ struct msp432_flash
 	target_addr FlashCtl_programMemory; /* Flash programming routine in ROM */
 };
 
+/* ROM calls queued for the trampoline, see flashstub/msp432.s */
+struct msp432_desc
+{
+	uint32_t src; /* Buffer in SRAM, or 0 to erase */
+	uint32_t dest;
+	uint32_t len; /* 0 ends the list */
+};
+
+struct msp432_priv_s
+{
+	struct msp432_flash *queue_flash; /* Flash bank the queue is for */
+	uint32_t queue_len;
+	uint32_t queue_sectors; /* Sectors to unprotect for the queue */
+	struct msp432_desc queue[QUEUE_LEN + 1];
+};
+
+static const uint16_t msp432_flash_stub[] = {
+#include "flashstub/msp432.stub"
+};
+
 /* Flash operations */
 static bool msp432_sector_erase(struct target_flash *f, target_addr addr);
 static int msp432_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int msp432_flash_write(struct target_flash *f, target_addr dest,
 			      const void *src, size_t len);
+static int msp432_flash_done(struct target_flash *f);
 
 /* Utility functions */
 /* Find the the target flash that conatins a specific address */
@@ -120,16 +144,19 @@ static struct target_flash *get_target_flash(target *t, target_addr addr);
 /* Call a subroutine in the MSP432 ROM (or anywhere else...)*/
 static void msp432_call_ROM(target *t, uint32_t address, uint32_t regs[]);
 
-/* Protect or unprotect the sector containing address */
-static inline uint32_t msp432_sector_unprotect(struct msp432_flash *mf, target_addr addr)
+/* Bit representing the sector containing address in WEPROT */
+static inline uint32_t msp432_sector_bit(struct msp432_flash *mf, target_addr addr)
+{
+	return 1u << ((addr - mf->f.start) / SECTOR_SIZE);
+}
+
+/* Unprotect the sectors in sectors, returns the old protection */
+static inline uint32_t msp432_sectors_unprotect(struct msp432_flash *mf, uint32_t sectors)
 {
 	/* Read the old protection register */
 	uint32_t old_mask = target_mem_read32(mf->f.t, mf->flash_protect_register);
-	/* Find the bit representing the sector and set it to 0  */
-	uint32_t sec_mask = ~(1u << ((addr - mf->f.start) / SECTOR_SIZE));
-	/* Clear the potection bit */
-	sec_mask &= old_mask;
-	target_mem_write32(mf->f.t, mf->flash_protect_register, sec_mask);
+	/* Clear the potection bits */
+	target_mem_write32(mf->f.t, mf->flash_protect_register, old_mask & ~sectors);
 	return old_mask;
 }
 
@@ -160,6 +187,7 @@ static void msp432_add_flash(target *t, uint32_t addr, size_t length, target_add
 	f->blocksize = SECTOR_SIZE;
 	f->erase = msp432_flash_erase;
 	f->write = msp432_flash_write;
+	f->done = msp432_flash_done;
 	f->buf_size = SRAM_WRITE_BUF_SIZE;
 	f->erased = 0xff;
 	target_add_flash(t, f);
@@ -210,6 +238,13 @@ bool msp432_probe(target *t)
 		/* Unknown device, not an MSP432 or not a real TLV */
 		return false;
 	}
+	struct msp432_priv_s *priv = calloc(1, sizeof(*priv));
+	if (!priv) {			/* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	t->target_storage = priv;
+
 	/* SRAM region, SRAM zone */
 	target_add_ram(t, SRAM_BASE, target_mem_read32(t, SYS_SRAM_SIZE));
 	/* Flash bank size */
@@ -231,87 +266,138 @@ bool msp432_probe(target *t)
 }
 
 /* Flash operations */
-/* Erase a single sector at addr calling the ROM routine*/
-static bool msp432_sector_erase(struct target_flash *f, target_addr addr)
+/* Run the queued ROM calls through the trampoline, in one halt/resume */
+static int msp432_queue_flush(target *t)
 {
-	target *t = f->t;
-	struct msp432_flash *mf = (struct msp432_flash *)f;
+	struct msp432_priv_s *priv = t->target_storage;
+	struct msp432_flash *mf = priv->queue_flash;
+
+	if (!priv->queue_len)
+		return 0;
 
-	/* Unprotect sector */
-	uint32_t old_prot = msp432_sector_unprotect(mf, addr);
-	DEBUG_WARN("Flash protect: 0x%08"PRIX32"\n",
+	/* Unprotect sectors */
+	uint32_t old_prot = msp432_sectors_unprotect(mf, priv->queue_sectors);
+	DEBUG_INFO("Flash protect: 0x%08"PRIX32"\n",
 			   target_mem_read32(t, mf->flash_protect_register));
 
+	/* Upload the trampoline and the terminated descriptor list */
+	memset(&priv->queue[priv->queue_len], 0, sizeof(priv->queue[0]));
+	target_mem_write(t, SRAM_TRAMPOLINE, msp432_flash_stub,
+			 sizeof(msp432_flash_stub));
+	target_mem_write(t, SRAM_DESC_LIST, priv->queue,
+			 (priv->queue_len + 1) * sizeof(priv->queue[0]));
+
 	/* Prepare input data */
 	uint32_t regs[t->regs_size / sizeof(uint32_t)]; // Use of VLA
 	target_regs_read(t, regs);
-	regs[0] = addr; // Address of sector to erase in R0
-
-	DEBUG_INFO("Erasing sector at 0x%08"PRIX32"\n", addr);
+	regs[4] = SRAM_DESC_LIST;             // Descriptor list in R4
+	regs[5] = mf->FlashCtl_programMemory; // ROM routines in R5 and R6
+	regs[6] = mf->FlashCtl_eraseSector;
 
+	DEBUG_INFO("Running %"PRIu32" ROM calls\n", priv->queue_len);
 	/* Call ROM */
-	msp432_call_ROM(t, mf->FlashCtl_eraseSector, regs);
+	msp432_call_ROM(t, SRAM_TRAMPOLINE | 1, regs);
+
+	/* Restore original protection */
+	target_mem_write32(t, mf->flash_protect_register, old_prot);
+
+	priv->queue_len = 0;
+	priv->queue_sectors = 0;
+	priv->queue_flash = NULL;
 
 	// Result value in R0 is true for success
 	DEBUG_INFO("ROM return value: %"PRIu32"\n", regs[0]);
+	if (!regs[0]) {
+		/* R4 has already moved past the failed descriptor */
+		DEBUG_WARN("MSP432 ROM call %"PRIu32" failed\n",
+			   (regs[4] - SRAM_DESC_LIST) / (uint32_t)sizeof(priv->queue[0]) - 1);
+		return -1;
+	}
+	return 0;
+}
 
-	/* Restore original protection */
-	target_mem_write32(t, mf->flash_protect_register, old_prot);
+/* Queue a ROM call, running the queue first if it is full or for
+ * another flash bank */
+static int msp432_queue_add(struct msp432_flash *mf, uint32_t src,
+			    target_addr dest, size_t len)
+{
+	target *t = mf->f.t;
+	struct msp432_priv_s *priv = t->target_storage;
+	int ret = 0;
 
-	return !regs[0];
+	if ((priv->queue_len == QUEUE_LEN) ||
+	    (priv->queue_len && (priv->queue_flash != mf)))
+		ret = msp432_queue_flush(t);
+
+	priv->queue_flash = mf;
+	priv->queue[priv->queue_len].src = src;
+	priv->queue[priv->queue_len].dest = dest;
+	priv->queue[priv->queue_len].len = len;
+	priv->queue_len++;
+	priv->queue_sectors |= msp432_sector_bit(mf, dest);
+	return ret;
+}
+
+/* Erase a single sector at addr calling the ROM routine, returns true
+ * on success */
+static bool msp432_sector_erase(struct target_flash *f, target_addr addr)
+{
+	struct msp432_flash *mf = (struct msp432_flash *)f;
+
+	DEBUG_INFO("Erasing sector at 0x%08"PRIX32"\n", addr);
+	int ret = msp432_queue_add(mf, 0, addr, SECTOR_SIZE);
+	ret |= msp432_queue_flush(f->t);
+	return !ret;
 }
 
 /* Erase from addr for len bytes */
 static int msp432_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
+	struct msp432_flash *mf = (struct msp432_flash *)f;
 	int ret = 0;
 	while (len) {
-		ret |= msp432_sector_erase(f, addr);
+		DEBUG_INFO("Erasing sector at 0x%08"PRIX32"\n", addr);
+		ret |= msp432_queue_add(mf, 0, addr, f->blocksize);
 
 		/* update len and addr */
-		len -= f->blocksize;
+		addr += f->blocksize;
 		if (len > f->blocksize)
 			len -= f->blocksize;
 		else
 			len = 0;
 	}
+	ret |= msp432_queue_flush(f->t);
 
 	return ret;
 }
 
-/* Program flash */
+/* Program flash: queue the buffer, the ROM calls run once the queue is
+ * full or at done */
 static int msp432_flash_write(struct target_flash *f, target_addr dest,
 			      const void *src, size_t len)
 {
 	struct msp432_flash *mf = (struct msp432_flash *)f;
 	target *t = f->t;
+	struct msp432_priv_s *priv = t->target_storage;
+	int ret = 0;
 
-	/* Prepare RAM buffer in target */
-	target_mem_write(t, SRAM_WRITE_BUFFER, src, len);
-
-	/* Unprotect sector, len is always < SECTOR_SIZE */
-	uint32_t old_prot = msp432_sector_unprotect(mf, dest);
-
-	DEBUG_WARN("Flash protect: 0x%08"PRIX32"\n",
-			   target_mem_read32(t, mf->flash_protect_register));
-
-	/* Prepare input data */
-	uint32_t regs[t->regs_size / sizeof(uint32_t)]; // Use of VLA
-	target_regs_read(t, regs);
-	regs[0] = SRAM_WRITE_BUFFER; // Address of buffer to be flashed in R0
-	regs[1] = dest;              // Flash address to be write to in R1
-	regs[2] = len;               // Size of buffer to be flashed in R2
+	/* Make room, the buffers are used in queue order */
+	if ((priv->queue_len == QUEUE_LEN) ||
+	    (priv->queue_len && (priv->queue_flash != mf)))
+		ret = msp432_queue_flush(t);
 
-	DEBUG_INFO("Writing 0x%04" PRIX32 " bytes at 0x%08zu\n", dest, len);
-	/* Call ROM */
-	msp432_call_ROM(t, mf->FlashCtl_programMemory, regs);
+	/* Prepare RAM buffer in target */
+	uint32_t buf = SRAM_WRITE_BUFFER + priv->queue_len * SRAM_WRITE_BUF_SIZE;
+	target_mem_write(t, buf, src, len);
 
-	/* Restore original protection */
-	target_mem_write32(t, mf->flash_protect_register, old_prot);
+	DEBUG_INFO("Writing 0x%04zx bytes at 0x%08"PRIX32"\n", len, dest);
+	ret |= msp432_queue_add(mf, buf, dest, len);
+	return ret;
+}
 
-	DEBUG_INFO("ROM return value: %"PRIu32"\n", regs[0]);
-	// Result value in R0 is true for success
-	return !regs[0];
+static int msp432_flash_done(struct target_flash *f)
+{
+	return msp432_queue_flush(f->t);
 }
 
 /* Optional commands handlers */
@@ -19,6 +19,11 @@
 
 /* This file implements nRF51 target specific functions for detecting
  * the device, providing the XML memory map and Flash memory programming.
+ *
+ * Code flash is programmed by a resident RAM stub, flashstub/nrf51.s,
+ * which polls NVMC READY on the target.  It works from two buffers so
+ * the next page is uploaded while the previous one is programmed.  The
+ * UICR and targets short of RAM are written through the NVMC registers.
  */
 
 #include "general.h"
@@ -29,6 +34,7 @@
 static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int nrf51_flash_write(struct target_flash *f,
                              target_addr dest, const void *src, size_t len);
+static int nrf51_flash_done(struct target_flash *f);
 
 static bool nrf51_cmd_erase_all(target *t, int argc, const char **argv);
 static bool nrf51_cmd_erase_uicr(target *t, int argc, const char **argv);
@@ -96,21 +102,61 @@ const struct command_s nrf51_read_cmd_list[] = {
 #define NRF51_PAGE_SIZE 1024
 #define NRF52_PAGE_SIZE 4096
 
-static void nrf51_add_flash(target *t,
-                            uint32_t addr, size_t length, size_t erasesize)
+static const uint16_t nrf51_flash_stub[] = {
+#include "flashstub/nrf51.stub"
+};
+
+/* RAM layout while the stub runs: stub, control block, two buffers */
+#define SRAM_BASE          0x20000000
+#define STUB_CTRL          ALIGN(SRAM_BASE + sizeof(nrf51_flash_stub), 4)
+#define STUB_SLOT_SIZE     12
+#define STUB_SLOT_DEST     0
+#define STUB_SLOT_WORDS    4
+#define STUB_SLOT_SRC      8
+#define STUB_SLOT_STOP     0xffffffff
+#define STUB_BUFFER_BASE   (STUB_CTRL + 2 * STUB_SLOT_SIZE)
+#define STUB_RAM_SIZE(buf) (STUB_BUFFER_BASE + 2 * (buf) - SRAM_BASE)
+
+struct nrf51_flash {
+	struct target_flash f;
+	bool use_stub;
+};
+
+/* Stub state, per target.  Every NVMC access outside the stub has to
+ * wait until the stub is stopped, whichever region it belongs to. */
+struct nrf51_priv_s {
+	struct nrf51_flash *stub_flash;
+	bool stub_running;
+	uint8_t slot;
+};
+
+static void nrf51_add_flash(target *t, uint32_t addr, size_t length,
+                            size_t erasesize, bool use_stub)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
+	struct nrf51_flash *nf = calloc(1, sizeof(*nf));
+	if (!nf) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	struct target_flash *f = &nf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = nrf51_flash_erase;
 	f->write = nrf51_flash_write;
+	f->done = nrf51_flash_done;
 	f->erased = 0xff;
+	if (use_stub) {
+		struct nrf51_priv_s *priv = calloc(1, sizeof(*priv));
+		if (priv) {
+			/* One page per buffer */
+			f->buf_size = erasesize;
+			nf->use_stub = true;
+			priv->stub_flash = nf;
+			t->target_storage = priv;
+		}
+	}
 	target_add_flash(t, f);
 }
 
@@ -137,8 +183,9 @@ bool nrf51_probe(target *t)
 		t->driver = "Nordic nRF52";
 		t->target_options |= CORTEXM_TOPT_INHIBIT_SRST;
 		target_add_ram(t, 0x20000000, ram_size * 1024);
-		nrf51_add_flash(t, 0, page_size * code_size, page_size);
-		nrf51_add_flash(t, NRF51_UICR, page_size, page_size);
+		nrf51_add_flash(t, 0, page_size * code_size, page_size,
+		                STUB_RAM_SIZE(page_size) <= ram_size * 1024);
+		nrf51_add_flash(t, NRF51_UICR, page_size, page_size, false);
 		target_add_commands(t, nrf51_cmd_list, "nRF52");
 		return true;
 	} else {
@@ -148,17 +195,129 @@ bool nrf51_probe(target *t)
 		 * there is later no usage.*/
 		target_add_ram(t, 0x20000000, 0x8000);
 		t->target_options |= CORTEXM_TOPT_INHIBIT_SRST;
-		nrf51_add_flash(t, 0, page_size * code_size, page_size);
-		nrf51_add_flash(t, NRF51_UICR, page_size, page_size);
+		/* All nRF51 have at least 16 KiB of RAM */
+		nrf51_add_flash(t, 0, page_size * code_size, page_size,
+		                STUB_RAM_SIZE(page_size) <= 0x4000);
+		nrf51_add_flash(t, NRF51_UICR, page_size, page_size, false);
 		target_add_commands(t, nrf51_cmd_list, "nRF51");
 		return true;
 	}
 	return false;
 }
 
+/* Stop the stub once it has programmed all handed over buffers. */
+static int nrf51_flash_stub_stop(target *t)
+{
+	struct nrf51_priv_s *priv = t->target_storage;
+
+	if (!priv || !priv->stub_running)
+		return 0;
+	priv->stub_running = false;
+
+	/* The stub works through the slots in order, so the stop request
+	 * goes to the slot after the last one handed over. */
+	uint32_t slot = STUB_CTRL + priv->slot * STUB_SLOT_SIZE;
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 5000);
+	while (target_mem_read32(t, slot + STUB_SLOT_WORDS)) {
+		if (target_check_error(t) ||
+		    platform_timeout_is_expired(&timeout))
+			break;
+	}
+	target_mem_write32(t, slot + STUB_SLOT_WORDS, STUB_SLOT_STOP);
+
+	int ret = cortexm_wait_stub(t, 5000);
+	if (ret)
+		DEBUG_WARN("nrf51 flash stub error %d\n", ret);
+
+	/* Return to read-only */
+	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_REN);
+	return ret ? -1 : 0;
+}
+
+/* Hand the stub its last buffered page and stop it.  Needed before
+ * any direct NVMC access, as the stub can not notice CONFIG changing
+ * under it. */
+static int nrf51_flash_stub_flush(target *t)
+{
+	struct nrf51_priv_s *priv = t->target_storage;
+
+	if (!priv)
+		return 0;
+	int ret = target_flash_done_buffered(&priv->stub_flash->f);
+	if (nrf51_flash_stub_stop(t))
+		ret = -1;
+	return ret;
+}
+
+/* Hand one buffer to the stub, starting it for the first buffer of a
+ * session.  Returns once the data is in target RAM, not programmed. */
+static int nrf51_flash_stub_write(struct nrf51_flash *nf,
+                                  target_addr dest, const void *src,
+                                  size_t len)
+{
+	target *t = nf->f.t;
+	struct nrf51_priv_s *priv = t->target_storage;
+
+	if (!priv->stub_running) {
+		target_mem_write(t, SRAM_BASE, nrf51_flash_stub,
+		                 sizeof(nrf51_flash_stub));
+		for (int i = 0; i < 2; i++)
+			target_mem_write32(t, STUB_CTRL + i * STUB_SLOT_SIZE +
+			                   STUB_SLOT_WORDS, 0);
+		/* Enable write */
+		target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
+		while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
+			if(target_check_error(t))
+				return -1;
+		if (cortexm_start_stub(t, SRAM_BASE, STUB_CTRL, 0, 0,
+		                       NRF51_NVMC_READY))
+			return -1;
+		priv->stub_running = true;
+		priv->slot = 0;
+	}
+
+	/* Wait for the stub to finish with the buffer we are about to
+	 * refill, which it programmed two writes ago. */
+	uint32_t slot = STUB_CTRL + priv->slot * STUB_SLOT_SIZE;
+	uint32_t buf = STUB_BUFFER_BASE + priv->slot * nf->f.buf_size;
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 5000);
+	while (target_mem_read32(t, slot + STUB_SLOT_WORDS)) {
+		if (target_check_error(t) ||
+		    platform_timeout_is_expired(&timeout) ||
+		    target_halt_poll(t, NULL) != TARGET_HALT_RUNNING) {
+			nrf51_flash_stub_stop(t);
+			return -1;
+		}
+	}
+
+	target_mem_write(t, buf, src, len);
+	target_mem_write32(t, slot + STUB_SLOT_DEST, dest);
+	target_mem_write32(t, slot + STUB_SLOT_SRC, buf);
+	target_mem_write32(t, slot + STUB_SLOT_WORDS, len / 4);
+	if (target_check_error(t))
+		return -1;
+
+	priv->slot ^= 1;
+	return 0;
+}
+
+static int nrf51_flash_done(struct target_flash *f)
+{
+	/* UICR comes first in the flash list, so flush the code flash
+	 * pages through the stub from whichever region is done first */
+	return nrf51_flash_stub_flush(f->t);
+}
+
 static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
 	target *t = f->t;
+
+	/* Erase needs the NVMC in erase mode, so finish pending writes */
+	if (nrf51_flash_stub_flush(t))
+		return -1;
+
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
 
@@ -203,8 +362,15 @@ static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t le
 static int nrf51_flash_write(struct target_flash *f,
                              target_addr dest, const void *src, size_t len)
 {
+	struct nrf51_flash *nf = (struct nrf51_flash *)f;
 	target *t = f->t;
 
+	if (nf->use_stub)
+		return nrf51_flash_stub_write(nf, dest, src, len);
+
+	if (nrf51_flash_stub_flush(t))
+		return -1;
+
 	/* Enable write */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
 	/* Poll for NVMC_READY */
@@ -227,6 +393,9 @@ static bool nrf51_cmd_erase_all(target *t, int argc, const char **argv)
 	(void)argv;
 	tc_printf(t, "erase..\n");
 
+	if (nrf51_flash_stub_stop(t))
+		return false;
+
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
 
@@ -252,6 +421,9 @@ static bool nrf51_cmd_erase_uicr(target *t, int argc, const char **argv)
 	(void)argv;
 	tc_printf(t, "erase..\n");
 
+	if (nrf51_flash_stub_stop(t))
+		return false;
+
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
 
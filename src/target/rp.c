@@ -33,8 +33,14 @@
  */
 
 /* This file implements Raspberry Pico (RP2040) target specific functions
- * for detecting the device, providing the XML memory map but not yet
- * Flash memory programming.
+ * for detecting the device, providing the XML memory map and Flash memory
+ * programming through the bootrom functions.
+ *
+ * The flash is taken out of XIP mode once per flash sequence.  Writes
+ * alternate between two SRAM buffers, so the next buffer is uploaded
+ * while the bootrom programs the previous one.
+ *
+ * Core 1 is attached along with core 0 and shown as GDB thread 2.
  */
 
 #include "general.h"
@@ -60,6 +66,10 @@ struct rp_priv_s {
 	uint16_t reset_usb_boot;
 	bool     is_prepared;
 	bool     is_monitor;
+	/* flash_range_program running in the background, see rp_flash_write */
+	bool     write_pending;
+	uint8_t  write_buf;
+	uint32_t write_timeout;
 	uint32_t regs[0x20];/* Register playground*/
 };
 
@@ -110,28 +120,31 @@ static bool rp2040_fill_table(struct rp_priv_s *priv, uint16_t *table, int max)
 	return (check != 9);
 }
 
-/* RP ROM functions calls
- *
- * timout == 0: Do not wait for poll, use for reset_usb_boot()
- * timeout > 500 (ms) : display spinner
- */
-static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd,
-						uint32_t timeout)
+/* Start a RP ROM function call through the debug trampoline */
+static void rp_rom_call_start(target *t, uint32_t *regs, uint32_t cmd)
 {
-	const char spinner[] = "|/-\\";
-	int spinindex = 0;
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
 	regs[7] = cmd;
 	regs[REG_LR] = ps->_debug_trampoline_end;
 	regs[REG_PC] = ps->_debug_trampoline;
 	regs[REG_MSP] = 0x20042000;
 	regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
-	uint32_t dbg_regs[t->regs_size / sizeof(uint32_t)];
 	target_regs_write(t, regs);
-	/* start the target and wait for it to halt again */
+	/* start the target, the trampoline ends in a breakpoint */
 	target_halt_resume(t, false);
-	if (!timeout)
-		return false;
+}
+
+/* Wait for a ROM function call started with rp_rom_call_start() to
+ * return to the trampoline breakpoint.
+ *
+ * timeout > 500 (ms) : display spinner
+ */
+static bool rp_rom_call_wait(target *t, uint32_t cmd, uint32_t timeout)
+{
+	const char spinner[] = "|/-\\";
+	int spinindex = 0;
+	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	uint32_t dbg_regs[t->regs_size / sizeof(uint32_t)];
 	DEBUG_INFO("Call cmd %04" PRIx32 "\n", cmd);
 	platform_timeout to;
 	platform_timeout_set(&to, timeout);
@@ -162,6 +175,34 @@ static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd,
 	return ret;
 }
 
+/* RP ROM functions calls
+ *
+ * timout == 0: Do not wait for poll, use for reset_usb_boot()
+ * timeout > 500 (ms) : display spinner
+ */
+static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd,
+						uint32_t timeout)
+{
+	rp_rom_call_start(t, regs, cmd);
+	if (!timeout)
+		return false;
+	return rp_rom_call_wait(t, cmd, timeout);
+}
+
+/* Wait for a flash_range_program call left running by rp_flash_write */
+static bool rp_flash_write_wait(target *t)
+{
+	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	if (!ps->write_pending)
+		return false;
+	ps->write_pending = false;
+	bool ret = rp_rom_call_wait(t, ps->flash_range_program,
+								ps->write_timeout);
+	if (ret)
+		DEBUG_WARN("Write failed!\n");
+	return ret;
+}
+
 static void rp_flash_prepare(target *t)
 {
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
@@ -178,6 +219,7 @@ static void rp_flash_prepare(target *t)
 static void rp_flash_resume(target *t)
 {
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	rp_flash_write_wait(t);
 	if (ps->is_prepared) {
 		DEBUG_INFO("rp_flash_resume\n");
 		/* flush */
@@ -188,6 +230,8 @@ static void rp_flash_resume(target *t)
 	}
 }
 
+#define MAX_WRITE_CHUNK 0x1000
+
 /* FLASHCMD_SECTOR_ERASE  45/  400 ms
  * 32k block erase       120/ 1600 ms
  * 64k block erase       150/ 2000 ms
@@ -207,6 +251,8 @@ static int rp_flash_erase(struct target_flash *f, target_addr addr,
 	}
 	DEBUG_INFO("Erase addr %08" PRIx32 " len 0x%" PRIx32 "\n", addr, (uint32_t)len);
 	target *t = f->t;
+	if (rp_flash_write_wait(t))
+		return -1;
 	rp_flash_prepare(t);
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
 	/* Register playground*/
@@ -258,50 +304,56 @@ static int rp_flash_erase(struct target_flash *f, target_addr addr,
 			break;
 		}
 	}
-	rp_flash_resume(t);
 	DEBUG_INFO("Erase done!\n");
 	return ret;
 }
 
+/* Program one buffer. The buffer is uploaded while the previous one is
+ * still being programmed, alternating between two SRAM buffers, and the
+ * ROM call is left running. rp_flash_done() waits for the last one.
+ */
 static int rp_flash_write(struct target_flash *f,
                     target_addr dest, const void *src, size_t len)
 {
 	DEBUG_INFO("RP Write %08" PRIx32 " len 0x%" PRIx32 "\n", dest, (uint32_t)len);
-	if ((dest & 0xff) || (len & 0xff)) {
+	if ((dest & 0xff) || (len & 0xff) || (len > MAX_WRITE_CHUNK)) {
 		DEBUG_WARN("Unaligned erase\n");
 		return -1;
 	}
 	target *t = f->t;
-	rp_flash_prepare(t);
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	uint32_t buf = SRAM_START + ps->write_buf * MAX_WRITE_CHUNK;
 	/* Write payload to target ram */
-	dest -= XIP_FLASH_START;
-	bool ret = 0;
-#define MAX_WRITE_CHUNK 0x1000
-	while (len) {
-		uint32_t chunksize = (len <= MAX_WRITE_CHUNK) ? len : MAX_WRITE_CHUNK;
-		target_mem_write(t, SRAM_START, src, chunksize);
-		/* Programm range */
-		ps->regs[0] = dest;
-		ps->regs[1] = SRAM_START;
-		ps->regs[2] = chunksize;
-		/* Loading takes 3 ms per 256 byte page
-		 * however it takes much longer if the XOSC is not enabled
-		 * so lets give ourselves a little bit more time (x10)
-		 */
-		ret |= rp_rom_call(t, ps->regs, ps->flash_range_program,
-					(3 *  chunksize * 10) >> 8);
-		if (ret) {
-			DEBUG_WARN("Write failed!\n");
-			break;
-		}
-		len -= chunksize;
-		src += chunksize;
-		dest += chunksize;
-	}
+	target_mem_write(t, buf, src, len);
+	if (rp_flash_write_wait(t))
+		return -1;
+	rp_flash_prepare(t);
+	/* Programm range */
+	ps->regs[0] = dest - XIP_FLASH_START;
+	ps->regs[1] = buf;
+	ps->regs[2] = len;
+	/* Loading takes 3 ms per 256 byte page
+	 * however it takes much longer if the XOSC is not enabled
+	 * so lets give ourselves a little bit more time (x10)
+	 */
+	ps->write_timeout = (3 * len * 10) >> 8;
+	rp_rom_call_start(t, ps->regs, ps->flash_range_program);
+	ps->write_pending = true;
+	ps->write_buf ^= 1;
+	return 0;
+}
+
+/* Finish a flash sequence: wait for the last write and return the
+ * flash to XIP mode. */
+static int rp_flash_done(struct target_flash *f)
+{
+	target *t = f->t;
+	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	bool ret = rp_flash_write_wait(t);
 	rp_flash_resume(t);
-	DEBUG_INFO("Write done!\n");
-	return ret;
+	ps->write_buf = 0;
+	DEBUG_INFO("Flash done!\n");
+	return ret ? -1 : 0;
 }
 
 static bool rp_cmd_reset_usb_boot(target *t, int argc, const char *argv[])
@@ -328,6 +380,7 @@ static bool rp_cmd_erase_mass(target *t, int argc, const char *argv[])
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
 	ps->is_monitor = true;
 	bool res =  (rp_flash_erase(&f, XIP_FLASH_START, MAX_FLASH)) ? false: true;
+	rp_flash_resume(t);
 	ps->is_monitor = false;
 	return res;
 }
@@ -351,10 +404,20 @@ static void rp_add_flash(target *t, uint32_t addr, size_t length)
         f->blocksize = 0x1000;
         f->erase = rp_flash_erase;
         f->write = rp_flash_write;
-        f->buf_size = 2048; /* Max buffer size used eotherwise */
+        f->done = rp_flash_done;
+        f->buf_size = MAX_WRITE_CHUNK; /* Two of them in SRAM */
         target_add_flash(t, f);
 }
 
+static void rp_find_core0(int i, target *t, void *context)
+{
+	(void)i;
+	target **core0 = context;
+	if (!*core0 && t->driver && !strcmp(t->driver, RP_ID) &&
+	    ((cortexm_ap(t)->dp->targetid >> 28) == 0))
+		*core0 = t;
+}
+
 bool rp_probe(target *t)
 {
 	/* Check bootrom magic*/
@@ -411,6 +474,20 @@ bool rp_probe(target *t)
 	target_add_ram(t, SRAM_START, 0x40000);
 	target_add_ram(t, 0x51000000,  0x1000);
 	target_add_commands(t, rp_cmd_list, RP_ID);
+	/* Core 1 sits on its own multi-drop DP. Attach it together with
+	 * core 0, as a second thread. Only the bit-banged SW-DP re-selects
+	 * the DP between accesses, so other probes keep it separate. */
+	if ((cortexm_ap(t)->dp->targetid >> 28) == 1) {
+		if (cortexm_ap(t)->dp->low_access != firmware_swdp_low_access) {
+			DEBUG_WARN("RP2040 core 1 not shown as thread, probe "
+			           "can not switch DPs\n");
+			return true;
+		}
+		target *core0 = NULL;
+		target_foreach(rp_find_core0, &core0);
+		if (core0 && (core0 != t))
+			target_add_thread(core0, t);
+	}
 	return true;
 }
 
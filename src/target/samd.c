@@ -42,6 +42,7 @@
 static int samd_flash_erase(struct target_flash *t, target_addr addr, size_t len);
 static int samd_flash_write(struct target_flash *f,
                             target_addr dest, const void *src, size_t len);
+static int samd_flash_done(struct target_flash *f);
 
 bool samd_cmd_erase_all(target *t, int argc, const char **argv);
 static bool samd_cmd_lock_flash(target *t, int argc, const char **argv);
@@ -94,9 +95,22 @@ const struct command_s samd_cmd_list[] = {
 #define SAMD_CTRLA_CMD_SSB		0x0045
 #define SAMD_CTRLA_CMD_INVALL		0x0046
 
+/* Control B Register (CTRLB) */
+#define SAMD_CTRLB_MANW			(1 << 7)
+
 /* Interrupt Flag Register (INTFLAG) */
 #define SAMD_NVMC_READY			(1 << 0)
 
+/* Status Register (STATUS) */
+#define SAMD_STATUS_PROGE		(1 << 2)
+#define SAMD_STATUS_LOCKE		(1 << 3)
+#define SAMD_STATUS_NVME		(1 << 4)
+#define SAMD_STATUS_ERRORS		(SAMD_STATUS_PROGE | SAMD_STATUS_LOCKE | \
+					 SAMD_STATUS_NVME)
+
+/* The flash is split into 16 equally sized lock regions */
+#define SAMD_LOCK_REGIONS		16
+
 /* Non-Volatile Memory Calibration and Auxiliary Registers */
 #define SAMD_NVM_USER_ROW_LOW		0x00804000
 #define SAMD_NVM_USER_ROW_HIGH		0x00804004
@@ -447,20 +461,32 @@ struct samd_descr samd_parse_device_id(uint32_t did)
 	return samd;
 }
 
+struct samd_flash {
+	struct target_flash f;
+	uint32_t lock_region_size;
+	uint16_t unlocked;	/* Lock regions to lock again when done */
+	bool prepared;		/* Errors cleared, automatic page writes enabled */
+	uint32_t ctrlb;		/* CTRLB to restore when done */
+};
+
 static void samd_add_flash(target *t, uint32_t addr, size_t length)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
+	struct samd_flash *sf = calloc(1, sizeof(*sf));
+	struct target_flash *f;
+	if (!sf) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = SAMD_ROW_SIZE;
 	f->erase = samd_flash_erase;
 	f->write = samd_flash_write;
-	f->buf_size = SAMD_PAGE_SIZE;
+	f->done = samd_flash_done;
+	f->buf_size = SAMD_ROW_SIZE;
+	sf->lock_region_size = length / SAMD_LOCK_REGIONS;
 	target_add_flash(t, f);
 }
 
@@ -572,30 +598,78 @@ static void samd_unlock_current_address(target *t)
 	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_UNLOCK);
 }
 
+static int samd_wait_ready(target *t)
+{
+	/* Poll for NVM Ready */
+	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
+		if (target_check_error(t))
+			return -1;
+	return 0;
+}
+
+/**
+ * Unlock the lock region of addr, once per flash sequence.  The
+ * regions are locked again by samd_flash_done().
+ */
+static int samd_unlock_region(struct samd_flash *sf, target_addr addr)
+{
+	target *t = sf->f.t;
+	uint16_t region = 1 << ((addr - sf->f.start) / sf->lock_region_size);
+
+	if (sf->unlocked & region)
+		return 0;
+	if (samd_wait_ready(t))
+		return -1;
+	/* Must be shifted right for 16-bit address, see Datasheet §20.8.8 Address */
+	target_mem_write32(t, SAMD_NVMC_ADDRESS, addr >> 1);
+	samd_unlock_current_address(t);
+	sf->unlocked |= region;
+	return samd_wait_ready(t);
+}
+
+/**
+ * Start a flash sequence: clear errors left from before, so that
+ * samd_flash_done() only reports those of this sequence, and enable
+ * automatic page writes.
+ */
+static int samd_flash_prepare(struct samd_flash *sf)
+{
+	target *t = sf->f.t;
+
+	if (sf->prepared)
+		return 0;
+	if (samd_wait_ready(t))
+		return -1;
+	target_mem_write32(t, SAMD_NVMC_STATUS, SAMD_STATUS_ERRORS);
+	sf->ctrlb = target_mem_read32(t, SAMD_NVMC_CTRLB);
+	target_mem_write32(t, SAMD_NVMC_CTRLB, sf->ctrlb & ~SAMD_CTRLB_MANW);
+	sf->prepared = true;
+	return 0;
+}
+
 /**
  * Erase flash row by row
  */
 static int samd_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
+	struct samd_flash *sf = (struct samd_flash *)f;
 	target *t = f->t;
+
+	if (samd_flash_prepare(sf))
+		return -1;
 	while (len) {
+		if (samd_unlock_region(sf, addr))
+			return -1;
+
 		/* Write address of first word in row to erase it */
 		/* Must be shifted right for 16-bit address, see Datasheet §20.8.8 Address */
 		target_mem_write32(t, SAMD_NVMC_ADDRESS, addr >> 1);
 
-		/* Unlock */
-		samd_unlock_current_address(t);
-
 		/* Issue the erase command */
 		target_mem_write32(t, SAMD_NVMC_CTRLA,
 		                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_ERASEROW);
-		/* Poll for NVM Ready */
-		while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-			if (target_check_error(t))
-				return -1;
-
-		/* Lock */
-		samd_lock_current_address(t);
+		if (samd_wait_ready(t))
+			return -1;
 
 		addr += f->blocksize;
 		if (len > f->blocksize)
@@ -609,31 +683,68 @@ static int samd_flash_erase(struct target_flash *f, target_addr addr, size_t len
 
 /**
  * Write flash page by page
+ *
+ * With CTRLB.MANW clear, writing the last word of the page buffer
+ * starts the page write, so no write page command is needed.  Upload
+ * and page write don't overlap: each page is uploaded once the write
+ * of the previous one has finished, and samd_flash_done() waits for
+ * the last one.
  */
 static int samd_flash_write(struct target_flash *f,
                             target_addr dest, const void *src, size_t len)
 {
+	struct samd_flash *sf = (struct samd_flash *)f;
 	target *t = f->t;
 
-	/* Write within a single page. This may be part or all of the page */
-	target_mem_write(t, dest, src, len);
+	if (samd_flash_prepare(sf))
+		return -1;
 
-	/* Unlock */
-	samd_unlock_current_address(t);
+	for (size_t offset = 0; offset < len; offset += SAMD_PAGE_SIZE) {
+		if (samd_unlock_region(sf, dest + offset))
+			return -1;
+		/* Wait for the previous page to be written */
+		if (samd_wait_ready(t))
+			return -1;
+		target_mem_write(t, dest + offset, (const uint8_t *)src + offset,
+		                 SAMD_PAGE_SIZE);
+	}
 
-	/* Issue the write page command */
-	target_mem_write32(t, SAMD_NVMC_CTRLA,
-	                   SAMD_CTRLA_CMD_KEY | SAMD_CTRLA_CMD_WRITEPAGE);
+	return 0;
+}
 
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMD_NVMC_INTFLAG) & SAMD_NVMC_READY) == 0)
-		if (target_check_error(t))
-			return -1;
+/**
+ * Finish the last page write, relock the regions unlocked for erase
+ * or write and restore the write mode.
+ */
+static int samd_flash_done(struct target_flash *f)
+{
+	struct samd_flash *sf = (struct samd_flash *)f;
+	target *t = f->t;
+	int ret = 0;
 
-	/* Lock */
-	samd_lock_current_address(t);
+	if (samd_wait_ready(t))
+		return -1;
+	if (target_mem_read32(t, SAMD_NVMC_STATUS) & SAMD_STATUS_ERRORS) {
+		DEBUG_WARN("NVM error while erasing or writing flash\n");
+		ret = -1;
+	}
 
-	return 0;
+	for (int region = 0; region < SAMD_LOCK_REGIONS; region++) {
+		if (!(sf->unlocked & (1 << region)))
+			continue;
+		target_mem_write32(t, SAMD_NVMC_ADDRESS,
+		                   (f->start + region * sf->lock_region_size) >> 1);
+		samd_lock_current_address(t);
+		if (samd_wait_ready(t))
+			return -1;
+	}
+	sf->unlocked = 0;
+
+	if (sf->prepared) {
+		target_mem_write32(t, SAMD_NVMC_CTRLB, sf->ctrlb);
+		sf->prepared = false;
+	}
+	return ret;
 }
 
 /**
@@ -42,6 +42,7 @@ static int samx5x_flash_erase(struct target_flash *t, target_addr addr,
 			      size_t len);
 static int samx5x_flash_write(struct target_flash *f,
 			      target_addr dest, const void *src, size_t len);
+static int samx5x_flash_done(struct target_flash *f);
 static bool samx5x_cmd_lock_flash(target *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_flash(target *t, int argc, const char **argv);
 static bool samx5x_cmd_unlock_bootprot(target *t, int argc, const char **argv);
@@ -121,6 +122,12 @@ const struct command_s samx5x_protected_cmd_list[] = {
 #define SAMX5X_NVMC_ADDRESS			(SAMX5X_NVMC + 0x14)
 #define SAMX5X_NVMC_RUNLOCK			(SAMX5X_NVMC + 0x18)
 
+/* Control A Register (CTRLA) */
+#define SAMX5X_CTRLA_WMODE_MASK			(3 << 4)
+#define SAMX5X_CTRLA_WMODE_MAN			(0 << 4)
+#define SAMX5X_CTRLA_WMODE_AQW			(2 << 4)
+#define SAMX5X_CTRLA_WMODE_AP			(3 << 4)
+
 /* Control B Register (CTRLB) */
 #define SAMX5X_CTRLB_CMD_KEY			0xA500
 #define SAMX5X_CTRLB_CMD_ERASEPAGE		0x0000
@@ -326,21 +333,34 @@ struct samx5x_descr samx5x_parse_device_id(uint32_t did)
 	return samd;
 }
 
+struct samx5x_flash {
+	struct target_flash f;
+	uint32_t lock_region_size;
+	uint32_t unlocked;	/* Lock regions to lock again when done */
+	bool prepared;		/* Automatic page writes are enabled */
+	uint16_t ctrla;		/* CTRLA to restore when done */
+};
+
 static void samx5x_add_flash(target *t, uint32_t addr, size_t length,
 			     size_t erase_block_size, size_t write_page_size)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
+	struct samx5x_flash *sf = calloc(1, sizeof(*sf));
+	struct target_flash *f;
+	if (!sf) {			/* calloc failed: heap exhaustion */
 		DEBUG_INFO("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erase_block_size;
 	f->erase = samx5x_flash_erase;
 	f->write = samx5x_flash_write;
+	f->done = samx5x_flash_done;
 	f->buf_size = write_page_size;
+	/* The flash is split into 32 equally sized lock regions */
+	sf->lock_region_size = length >> 5;
 	target_add_flash(t, f);
 }
 
@@ -512,6 +532,38 @@ static int samx5x_check_nvm_error(target *t)
 	return -1;
 }
 
+static int samx5x_wait_ready(target *t)
+{
+	/* Poll for NVM Ready */
+	while ((target_mem_read16(t, SAMX5X_NVMC_STATUS) &
+		SAMX5X_STATUS_READY) == 0)
+		if (target_check_error(t) || samx5x_check_nvm_error(t))
+			return -1;
+
+	if (target_check_error(t) || samx5x_check_nvm_error(t))
+		return -1;
+	return 0;
+}
+
+/**
+ * Unlock the lock region of addr, once per flash sequence.  The
+ * regions are locked again by samx5x_flash_done().
+ */
+static int samx5x_unlock_region(struct samx5x_flash *sf, target_addr addr)
+{
+	target *t = sf->f.t;
+	uint32_t region = 1 << ((addr - sf->f.start) / sf->lock_region_size);
+
+	if (sf->unlocked & region)
+		return 0;
+	if (samx5x_wait_ready(t))
+		return -1;
+	target_mem_write32(t, SAMX5X_NVMC_ADDRESS, addr);
+	samx5x_unlock_current_address(t);
+	sf->unlocked |= region;
+	return samx5x_wait_ready(t);
+}
+
 #define NVM_ERROR_BITS_MSG						\
 	"Warning: Found NVM error bits set while preparing to %s\n"	\
 	"         flash block at 0x%08"PRIx32" (length 0x%zx).\n"	\
@@ -524,6 +576,7 @@ static int samx5x_check_nvm_error(target *t)
 static int samx5x_flash_erase(struct target_flash *f, target_addr addr,
 			      size_t len)
 {
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
 	target *t = f->t;
 	uint16_t errs = samx5x_read_nvm_error(t);
 	if (errs) {
@@ -552,31 +605,20 @@ static int samx5x_flash_erase(struct target_flash *f, target_addr addr,
         }
 
 	while (len) {
-		target_mem_write32(t, SAMX5X_NVMC_ADDRESS, addr);
+		if (samx5x_unlock_region(sf, addr))
+			return -1;
 
-		/* Unlock */
-		samx5x_unlock_current_address(t);
+		target_mem_write32(t, SAMX5X_NVMC_ADDRESS, addr);
 
 		/* Issue the erase command */
 		target_mem_write32(t, SAMX5X_NVMC_CTRLB,
 				   SAMX5X_CTRLB_CMD_KEY |
 				   SAMX5X_CTRLB_CMD_ERASEBLOCK);
 
-		/* Poll for NVM Ready */
-		while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) &
-			SAMX5X_STATUS_READY) == 0)
-                    if (target_check_error(t) || samx5x_check_nvm_error(t)) {
-                        DEBUG_WARN("NVM Ready\n");
-                        return -1;
-                    }
-
-		if (target_check_error(t) || samx5x_check_nvm_error(t)) {
-                    DEBUG_WARN("Error\n");
-                    return -1;
-                }
-
-		/* Lock */
-		samx5x_lock_current_address(t);
+		if (samx5x_wait_ready(t)) {
+			DEBUG_WARN("Error\n");
+			return -1;
+		}
 
 		addr += f->blocksize;
 		len -= f->blocksize;
@@ -587,48 +629,80 @@ static int samx5x_flash_erase(struct target_flash *f, target_addr addr,
 
 /**
  * Write flash page by page
+ *
+ * In automatic page write mode writing the last word of the page
+ * buffer starts the page write, so no command is needed.  The write is
+ * left to complete while the next page is prepared; we only wait for
+ * it before touching the page buffer again.
  */
 static int samx5x_flash_write(struct target_flash *f,
 			      target_addr dest, const void *src, size_t len)
 {
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
 	target *t = f->t;
-	bool error = false;
-	uint16_t errs = samx5x_read_nvm_error(t);
-	if (errs) {
-		DEBUG_INFO(NVM_ERROR_BITS_MSG, "write", dest, len);
-		samx5x_print_nvm_error(errs);
-		samx5x_clear_nvm_error(t);
+
+	if (!sf->prepared) {
+		uint16_t errs = samx5x_read_nvm_error(t);
+		if (errs) {
+			DEBUG_INFO(NVM_ERROR_BITS_MSG, "write", dest, len);
+			samx5x_print_nvm_error(errs);
+			samx5x_clear_nvm_error(t);
+		}
+		sf->ctrla = target_mem_read16(t, SAMX5X_NVMC_CTRLA);
+		target_mem_write16(t, SAMX5X_NVMC_CTRLA,
+				   (sf->ctrla & ~SAMX5X_CTRLA_WMODE_MASK) |
+				   SAMX5X_CTRLA_WMODE_AP);
+		sf->prepared = true;
 	}
 
-	/* Unlock */
-	target_mem_write32(t, SAMX5X_NVMC_ADDRESS, dest);
-	samx5x_unlock_current_address(t);
+	if (samx5x_unlock_region(sf, dest))
+		goto error;
+
+	/* Wait for the previous page to be written */
+	if (samx5x_wait_ready(t))
+		goto error;
 
-	/* Write within a single page. This may be part or all of the page */
+	/* Writing the whole page buffer starts the write */
 	target_mem_write(t, dest, src, len);
+	return 0;
 
-	/* Issue the write page command */
-	target_mem_write32(t, SAMX5X_NVMC_CTRLB,
-			   SAMX5X_CTRLB_CMD_KEY | SAMX5X_CTRLB_CMD_WRITEPAGE);
+error:
+	DEBUG_WARN("Error writing flash page at 0x%08"PRIx32
+		   " (len 0x%08zx)\n",  dest, len);
+	return -1;
+}
 
-	/* Poll for NVM Ready */
-	while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) &
-		SAMX5X_STATUS_READY) == 0)
-		if (target_check_error(t) || samx5x_check_nvm_error(t)) {
-			error = true;
-			break;
-		}
+/**
+ * Finish the last page write, relock the regions unlocked for erase
+ * or write and restore the write mode.
+ */
+static int samx5x_flash_done(struct target_flash *f)
+{
+	struct samx5x_flash *sf = (struct samx5x_flash *)f;
+	target *t = f->t;
+	int ret = 0;
 
-	if (error || target_check_error(t) || samx5x_check_nvm_error(t)) {
-		DEBUG_WARN("Error writing flash page at 0x%08"PRIx32
-		      " (len 0x%08zx)\n",  dest, len);
-		return -1;
+	if (samx5x_wait_ready(t)) {
+		DEBUG_WARN("Error writing flash\n");
+		ret = -1;
 	}
 
-	/* Lock */
-	samx5x_lock_current_address(t);
+	for (int region = 0; region < 32; region++) {
+		if (!(sf->unlocked & (1U << region)))
+			continue;
+		target_mem_write32(t, SAMX5X_NVMC_ADDRESS,
+				   f->start + region * sf->lock_region_size);
+		samx5x_lock_current_address(t);
+		if (samx5x_wait_ready(t))
+			ret = -1;
+	}
+	sf->unlocked = 0;
 
-	return 0;
+	if (sf->prepared) {
+		target_mem_write16(t, SAMX5X_NVMC_CTRLA, sf->ctrla);
+		sf->prepared = false;
+	}
+	return ret;
 }
 
 /**
@@ -657,24 +731,24 @@ static int samx5x_write_user_page(target *t, uint8_t *buffer)
 		if (target_check_error(t) || samx5x_check_nvm_error(t))
 			return -1;
 
-	/* Write back */
+	/* Write back, writing the last word of each quad word starts
+	 * its write in automatic quad word mode */
+	uint16_t ctrla = target_mem_read16(t, SAMX5X_NVMC_CTRLA);
+	target_mem_write16(t, SAMX5X_NVMC_CTRLA,
+			   (ctrla & ~SAMX5X_CTRLA_WMODE_MASK) |
+			   SAMX5X_CTRLA_WMODE_AQW);
+	int ret = 0;
 	for (uint32_t offset = 0; offset < SAMX5X_PAGE_SIZE; offset += 16) {
 		target_mem_write(t, SAMX5X_NVM_USER_PAGE + offset,
 				 buffer + offset, 16);
 
-		/* Issue the write page command */
-		target_mem_write32(t, SAMX5X_NVMC_CTRLB,
-				   SAMX5X_CTRLB_CMD_KEY |
-				   SAMX5X_CTRLB_CMD_WRITEQUADWORD);
-
-		/* Poll for NVM Ready */
-		while ((target_mem_read32(t, SAMX5X_NVMC_STATUS) &
-			SAMX5X_STATUS_READY) == 0)
-			if (target_check_error(t) ||
-			    samx5x_check_nvm_error(t))
-				return -2;
+		if (samx5x_wait_ready(t)) {
+			ret = -2;
+			break;
+		}
 	}
-	return 0;
+	target_mem_write16(t, SAMX5X_NVMC_CTRLA, ctrla);
+	return ret;
 }
 
 static int samx5x_update_user_word(target *t, uint32_t addr, uint32_t value,
@@ -36,6 +36,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "crc32.h"
 
 static bool stm32h7_cmd_erase_mass(target *t, int argc, const char **argv);
 /* static bool stm32h7_cmd_option(target *t, int argc, char *argv[]); */
@@ -63,6 +64,10 @@ static int stm32h7_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len);
 static int stm32h7_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+static int stm32h7_flash_done(struct target_flash *f);
+
+static int stm32h7_crc32(target *t, uint32_t *crc, target_addr base,
+                         size_t len);
 
 static const char stm32h7_driver_str[] = "STM32H7";
 
@@ -78,6 +83,8 @@ enum stm32h7_regs
 	FLASH_OPTSR_CUR = 0x1C,
 	FLASH_OPTSR     = 0x20,
 	FLASH_CRCCR		= 0x50,
+	FLASH_CRCSADD	= 0x54,
+	FLASH_CRCEADD	= 0x58,
 	FLASH_CRCDATA	= 0x5C,
 };
 
@@ -124,10 +131,17 @@ enum stm32h7_regs
 
 #define FLASH_OPTSR_IWDG1_SW	(1 <<  4)
 
+#define FLASH_CRCCR_CRC_SECT_SHIFT	0
 #define FLASH_CRCCR_ALL_BANK	(1 <<  7)
+#define FLASH_CRCCR_CRC_BY_SECT	(1 <<  8)
+#define FLASH_CRCCR_ADD_SECT	(1 <<  9)
+#define FLASH_CRCCR_CLEAN_SECT	(1 << 10)
 #define FLASH_CRCCR_START_CRC	(1 << 16)
 #define FLASH_CRCCR_CLEAN_CRC	(1 << 17)
-#define FLASH_CRCCR_CRC_BURST_3	(3 << 20)
+#define FLASH_CRCCR_CRC_BURST_0	(0 << 20) /* 4 flash words */
+#define FLASH_CRCCR_CRC_BURST_3	(3 << 20) /* 256 flash words */
+/* Smallest range the CRC unit can sum up by address */
+#define FLASH_CRC_BURST_0_SIZE	(4 * 32)
 
 #define KEY1 0x45670123
 #define KEY2 0xCDEF89AB
@@ -153,20 +167,41 @@ enum stm32h7_regs
 #define NUM_SECTOR_PER_BANK 8
 #define FLASH_SECTOR_SIZE 	0x20000
 #define BANK2_START         0x08100000
+#define BANK_SIZE           (NUM_SECTOR_PER_BANK * FLASH_SECTOR_SIZE)
 enum ID_STM32H7 {
 	ID_STM32H74x  = 0x450,      /* RM0433, RM0399 */
 	ID_STM32H7Bx  = 0x480,      /* RM0455 */
 	ID_STM32H72x  = 0x483,      /* RM0468 */
 };
 
+/* Each bank has its own controller. Erase and write only start the
+ * operation, completion is checked before the next operation on the same
+ * bank or in stm32h7_flash_done(). While waiting for one bank, the queue
+ * of the other bank is kept running, so both controllers work at once.
+ */
 struct stm32h7_flash {
 	struct target_flash f;
 	enum align psize;
 	uint32_t regbase;
+	int erase_next;   /* Next sector to erase */
+	int erase_end;    /* Last sector to erase */
+	bool busy;        /* Operation started, completion not yet seen */
+	bool failed;      /* Sticky until reported by stm32h7_flash_done() */
+	uint32_t sr_error;
+};
+
+/* How the flash CRC unit result relates to the qCRC value */
+enum stm32h7_crc_mode {
+	H7_CRC_UNKNOWN = 0, /* Not yet compared against generic_crc32() */
+	H7_CRC_GDB,         /* Same as generic_crc32() */
+	H7_CRC_INIT0,       /* Starts with 0 instead of all ones */
+	H7_CRC_UNUSABLE,    /* Different bit or byte order */
 };
 
 struct stm32h7_priv_s {
 	uint32_t dbg_cr;
+	enum stm32h7_crc_mode crc_mode;
+	bool flash_session; /* Erase or write since the last flash done */
 };
 
 static void stm32h7_add_flash(target *t,
@@ -186,12 +221,15 @@ static void stm32h7_add_flash(target *t,
 	f->blocksize = blocksize;
 	f->erase = stm32h7_flash_erase;
 	f->write = stm32h7_flash_write;
+	f->done = stm32h7_flash_done;
 	f->buf_size = 2048;
 	f->erased = 0xff;
 	sf->regbase = FPEC1_BASE;
 	if (addr >= BANK2_START)
 		sf->regbase = FPEC2_BASE;
 	sf->psize = ALIGN_DWORD;
+	sf->erase_next = 1;
+	sf->erase_end = 0;
 	target_add_flash(t, f);
 }
 
@@ -240,6 +278,8 @@ bool stm32h7_probe(target *t)
 		t->driver = stm32h7_driver_str;
 		t->attach = stm32h7_attach;
 		t->detach = stm32h7_detach;
+		if (idcode == ID_STM32H74x)
+			t->crc32 = stm32h7_crc32;
 		target_add_commands(t, stm32h7_cmd_list, stm32h7_driver_str);
 		/* Save private storage */
 		struct stm32h7_priv_s *priv_storage = calloc(1, sizeof(*priv_storage));
@@ -283,45 +323,117 @@ static bool stm32h7_flash_unlock(target *t, uint32_t addr)
 		return true;
 }
 
+static int stm32h7_bank(struct stm32h7_flash *sf)
+{
+	return (sf->regbase == FPEC2_BASE) ? 2 : 1;
+}
+
+/* Check a bank without blocking and start its next queued sector erase
+ * once the controller is idle. Returns false if the bank has failed.
+ */
+static bool stm32h7_flash_poll(target *t, struct stm32h7_flash *sf)
+{
+	if (sf->failed)
+		return false;
+	if (sf->busy) {
+		uint32_t sr = target_mem_read32(t, sf->regbase + FLASH_SR);
+		if (target_check_error(t)) {
+			DEBUG_WARN("stm32h7 bank %d: comm failed\n", stm32h7_bank(sf));
+			sf->failed = true;
+			return false;
+		}
+		if (sr & (FLASH_SR_QW | FLASH_SR_BSY))
+			return true;
+		sf->busy = false;
+		if (sr & FLASH_SR_ERROR_MASK) {
+			DEBUG_WARN("stm32h7 bank %d: error sr %08" PRIx32 "\n",
+			           stm32h7_bank(sf), sr);
+			target_mem_write32(t, sf->regbase + FLASH_CCR,
+			                   sr & FLASH_SR_ERROR_MASK);
+			sf->sr_error = sr;
+			sf->failed = true;
+			sf->erase_next = sf->erase_end + 1;
+			return false;
+		}
+	}
+	if (sf->erase_next <= sf->erase_end) {
+		uint32_t cr = (sf->psize * FLASH_CR_PSIZE16) | FLASH_CR_SER |
+			(sf->erase_next * FLASH_CR_SNB_1);
+		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
+		cr |= FLASH_CR_START;
+		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
+		DEBUG_INFO("stm32h7 bank %d: erase sector %d started\n",
+		           stm32h7_bank(sf), sf->erase_next);
+		sf->erase_next++;
+		sf->busy = true;
+	}
+	return true;
+}
+
+/* Wait until the given bank has finished all queued work, while polling
+ * the other bank as well.
+ */
+static int stm32h7_flash_wait(target *t, struct stm32h7_flash *wait_for)
+{
+	while (1) {
+		for (struct target_flash *f = t->flash; f; f = f->next) {
+			if (f->write == stm32h7_flash_write)
+				stm32h7_flash_poll(t, (struct stm32h7_flash *)f);
+		}
+		if (wait_for->failed)
+			return -1;
+		if (!wait_for->busy && (wait_for->erase_next > wait_for->erase_end))
+			return 0;
+	}
+}
+
+/* Forget what an earlier flash session left behind on both banks.
+ * target_flash_done() stops at the first bank that fails, so the done
+ * of the other bank may not have run.
+ */
+static void stm32h7_flash_session_start(target *t)
+{
+	struct stm32h7_priv_s *ps = (struct stm32h7_priv_s*)t->target_storage;
+	if (ps->flash_session)
+		return;
+	ps->flash_session = true;
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write != stm32h7_flash_write)
+			continue;
+		struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+		if (sf->busy) {
+			while (target_mem_read32(t, sf->regbase + FLASH_SR) &
+			       (FLASH_SR_QW | FLASH_SR_BSY)) {
+				if (target_check_error(t))
+					break;
+			}
+			target_mem_write32(t, sf->regbase + FLASH_CCR,
+			                   FLASH_SR_ERROR_MASK);
+		}
+		sf->busy = false;
+		sf->failed = false;
+		sf->sr_error = 0;
+		sf->erase_next = sf->erase_end + 1;
+	}
+}
+
 static int stm32h7_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len)
 {
 	target *t = f->t;
 	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	stm32h7_flash_session_start(t);
+	if (stm32h7_flash_wait(t, sf))
+		return -1;
 	if (stm32h7_flash_unlock(t, addr) == false)
 		return -1;
 	/* We come out of reset with HSI 64 MHz. Adapt FLASH_ACR.*/
 	target_mem_write32(t, sf->regbase + FLASH_ACR, 0);
 	addr &= (NUM_SECTOR_PER_BANK * FLASH_SECTOR_SIZE) - 1;
-	int start_sector =  addr / FLASH_SECTOR_SIZE;
-	int end_sector   = (addr + len - 1) / FLASH_SECTOR_SIZE;
-
-	enum align psize = ((struct stm32h7_flash *)f)->psize;
-	uint32_t sr;
-	while (start_sector <= end_sector) {
-		uint32_t cr = (psize * FLASH_CR_PSIZE16) | FLASH_CR_SER |
-			(start_sector * FLASH_CR_SNB_1);
-		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
-		cr |= FLASH_CR_START;
-		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
-		DEBUG_INFO(" started cr %08" PRIx32 " sr %08" PRIx32 "\n",
-				   target_mem_read32(t, sf->regbase + FLASH_CR),
-				   target_mem_read32(t, sf->regbase + FLASH_SR));
-		do {
-			sr = target_mem_read32(t, sf->regbase + FLASH_SR);
-			if (target_check_error(t)) {
-				DEBUG_WARN("stm32h7_flash_erase: comm failed\n");
-				return -1;
-			}
-//			target_mem_write32(t, H7_IWDG_BASE, 0x0000aaaa);
-		}while (sr & (FLASH_SR_QW | FLASH_SR_BSY));
-		if (sr & FLASH_SR_ERROR_MASK) {
-			DEBUG_WARN("stm32h7_flash_erase: error, sr: %08" PRIx32 "\n", sr);
-			return -1;
-		}
-		start_sector++;
-	}
-	return 0;
+	sf->erase_next = addr / FLASH_SECTOR_SIZE;
+	sf->erase_end  = (addr + len - 1) / FLASH_SECTOR_SIZE;
+	/* Only start the first sector here. */
+	return stm32h7_flash_poll(t, sf) ? 0 : -1;
 }
 
 static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
@@ -330,6 +442,9 @@ static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
 	target *t = f->t;
 	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
 	enum align psize = sf->psize;
+	stm32h7_flash_session_start(t);
+	if (stm32h7_flash_wait(t, sf))
+		return -1;
 	if (stm32h7_flash_unlock(t, dest) == false)
 		return -1;
 	uint32_t cr = psize * FLASH_CR_PSIZE16;
@@ -337,24 +452,35 @@ static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
 	cr |= FLASH_CR_PG;
 	target_mem_write32(t, sf->regbase + FLASH_CR, cr);
 	/* does H7 stall?*/
-	uint32_t sr_reg = sf->regbase + FLASH_SR;
-	uint32_t sr;
 	target_mem_write(t, dest, src, len);
-	while ((sr = target_mem_read32(t, sr_reg)) & FLASH_SR_BSY) {
-		if(target_check_error(t)) {
-			DEBUG_WARN("stm32h7_flash_write: BSY comm failed\n");
-			return -1;
-		}
-	}
-	if (sr & FLASH_SR_ERROR_MASK) {
-		DEBUG_WARN("stm32h7_flash_write: error sr %08" PRIx32 "\n", sr);
+	if (target_check_error(t)) {
+		DEBUG_WARN("stm32h7_flash_write: comm failed\n");
 		return -1;
 	}
-	/* Close write windows.*/
-	target_mem_write32(t, sf->regbase + FLASH_CR, 0);
+	sf->busy = true;
 	return 0;
 }
 
+static int stm32h7_flash_done(struct target_flash *f)
+{
+	target *t = f->t;
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	struct stm32h7_priv_s *ps = (struct stm32h7_priv_s*)t->target_storage;
+	ps->flash_session = false;
+	int ret = stm32h7_flash_wait(t, sf);
+	if (ret) {
+		DEBUG_WARN("stm32h7 bank %d: flash operation failed, sr %08" PRIx32
+		           "\n", stm32h7_bank(sf), sf->sr_error);
+		sf->failed = false;
+		sf->busy = false;
+		sf->sr_error = 0;
+	}
+	/* Close write windows.*/
+	if (!(target_mem_read32(t, sf->regbase + FLASH_CR) & FLASH_CR_LOCK))
+		target_mem_write32(t, sf->regbase + FLASH_CR, 0);
+	return ret;
+}
+
 /* Both banks are erased in parallel.*/
 static bool stm32h7_cmd_erase(target *t, int bank_mask)
 {
@@ -473,6 +599,25 @@ static bool stm32h7_uid(target *t, int argc, const char **argv)
 	tc_printf(t, "\n");
 	return true;
 }
+static int stm32h7_crc_wait(target *t, uint32_t regbase)
+{
+	uint32_t sr;
+	while ((sr = target_mem_read32(t, regbase + FLASH_SR)) &
+		   FLASH_SR_CRC_BUSY) {
+		if(target_check_error(t)) {
+			DEBUG_WARN("CRC bank %d: comm failed\n",
+					   (regbase == FPEC1_BASE) ? 1 : 2);
+			return -1;
+		}
+		if (sr & FLASH_SR_ERROR_READ) {
+			DEBUG_WARN("CRC bank %d: error sr %08" PRIx32 "\n",
+				  (regbase == FPEC1_BASE) ? 1 : 2, sr);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static int stm32h7_crc_bank(target *t, uint32_t bank)
 {
 	uint32_t regbase = FPEC1_BASE;
@@ -487,20 +632,118 @@ static int stm32h7_crc_bank(target *t, uint32_t bank)
 		FLASH_CRCCR_CLEAN_CRC | FLASH_CRCCR_ALL_BANK;
 	target_mem_write32(t, regbase + FLASH_CRCCR, crccr);
 	target_mem_write32(t, regbase + FLASH_CRCCR, crccr | FLASH_CRCCR_START_CRC);
-	uint32_t sr;
-	while ((sr = target_mem_read32(t, regbase + FLASH_SR)) &
-		   FLASH_SR_CRC_BUSY) {
-		if(target_check_error(t)) {
-			DEBUG_WARN("CRC bank %d: comm failed\n",
-					   (bank < BANK2_START) ? 1 : 2);
+	return stm32h7_crc_wait(t, regbase);
+}
+
+/* Start the CRC unit set up with crccr and collect its raw result */
+static int stm32h7_crc_run(target *t, uint32_t regbase, uint32_t crccr,
+                           uint32_t *crc)
+{
+	target_mem_write32(t, regbase + FLASH_CRCCR, crccr | FLASH_CRCCR_START_CRC);
+	int ret = stm32h7_crc_wait(t, regbase);
+	*crc = target_mem_read32(t, regbase + FLASH_CRCDATA);
+	target_mem_write32(t, regbase + FLASH_CR, 0);
+	return ret;
+}
+
+/* Raw flash CRC unit result for the whole sectors in [start, end),
+ * all in the same bank. CRCCR is written in full, so nothing is left
+ * over from an earlier use of the unit: sector mode, this bank only,
+ * bursts of 256 flash words and the result cleared.
+ */
+static int stm32h7_crc_sectors(target *t, uint32_t start, uint32_t end,
+                               uint32_t *crc)
+{
+	uint32_t regbase = (start >= BANK2_START) ? FPEC2_BASE : FPEC1_BASE;
+	if (stm32h7_flash_unlock(t, start) == false)
+		return -1;
+	target_mem_write32(t, regbase + FLASH_CR, FLASH_CR_CRC_EN);
+	uint32_t crccr = FLASH_CRCCR_CRC_BURST_3 | FLASH_CRCCR_CRC_BY_SECT;
+	target_mem_write32(t, regbase + FLASH_CRCCR, crccr |
+	                   FLASH_CRCCR_CLEAN_SECT | FLASH_CRCCR_CLEAN_CRC);
+	for (uint32_t addr = start; addr < end; addr += FLASH_SECTOR_SIZE) {
+		uint32_t sector = (addr & (BANK_SIZE - 1)) / FLASH_SECTOR_SIZE;
+		target_mem_write32(t, regbase + FLASH_CRCCR, crccr |
+		                   FLASH_CRCCR_ADD_SECT |
+		                   (sector << FLASH_CRCCR_CRC_SECT_SHIFT));
+	}
+	return stm32h7_crc_run(t, regbase, crccr, crc);
+}
+
+/* Raw flash CRC unit result for the single burst of 4 flash words at
+ * start, selected by address with the end address inclusive.
+ */
+static int stm32h7_crc_burst(target *t, uint32_t start, uint32_t *crc)
+{
+	uint32_t regbase = (start >= BANK2_START) ? FPEC2_BASE : FPEC1_BASE;
+	if (stm32h7_flash_unlock(t, start) == false)
+		return -1;
+	target_mem_write32(t, regbase + FLASH_CR, FLASH_CR_CRC_EN);
+	uint32_t crccr = FLASH_CRCCR_CRC_BURST_0;
+	target_mem_write32(t, regbase + FLASH_CRCCR, crccr | FLASH_CRCCR_CLEAN_CRC);
+	uint32_t offset = start & (BANK_SIZE - 1);
+	target_mem_write32(t, regbase + FLASH_CRCSADD, offset);
+	target_mem_write32(t, regbase + FLASH_CRCEADD,
+	                   offset + FLASH_CRC_BURST_0_SIZE - 4);
+	return stm32h7_crc_run(t, regbase, crccr, crc);
+}
+
+/* qCRC through the flash CRC unit. Whole sectors are summed up by the
+ * hardware, an unaligned head and tail are read with generic_crc32() and
+ * the parts are joined with crc32_combine(). The unit has a fixed
+ * polynomial and no initial value or bit order setting, so on first use
+ * its result for one 128 byte burst is compared against generic_crc32()
+ * to find out if and how it can be used.
+ */
+static int stm32h7_crc32(target *t, uint32_t *crc_res, target_addr base,
+                         size_t len)
+{
+	struct stm32h7_priv_s *ps = (struct stm32h7_priv_s*)t->target_storage;
+	uint32_t end = base + len;
+	uint32_t first = ALIGN(base, FLASH_SECTOR_SIZE);
+	uint32_t last = end & ~(FLASH_SECTOR_SIZE - 1);
+	if ((ps->crc_mode == H7_CRC_UNUSABLE) || (base < BANK1_START) ||
+	    (end > BANK2_START + BANK_SIZE) || (end < base) || (first >= last))
+		return 1;
+
+	uint32_t part;
+	if (ps->crc_mode == H7_CRC_UNKNOWN) {
+		uint32_t sw;
+		if (stm32h7_crc_burst(t, first, &part) ||
+			generic_crc32(t, &sw, first, FLASH_CRC_BURST_0_SIZE))
 			return -1;
+		if (part == sw) {
+			ps->crc_mode = H7_CRC_GDB;
+		} else if (crc32_combine(0, part, FLASH_CRC_BURST_0_SIZE) == sw) {
+			ps->crc_mode = H7_CRC_INIT0;
+		} else {
+			DEBUG_WARN("Flash CRC unit 0x%08" PRIx32 " does not match "
+			           "qCRC 0x%08" PRIx32 ", not using it\n", part, sw);
+			ps->crc_mode = H7_CRC_UNUSABLE;
+			return 1;
 		}
-		if (sr & FLASH_SR_ERROR_READ) {
-			DEBUG_WARN("CRC bank %d: error sr %08" PRIx32 "\n",
-				  (bank < BANK2_START) ? 1 : 2, sr);
+	}
+
+	uint32_t crc = 0xffffffff;
+	if (base < first) {
+		if (generic_crc32(t, &crc, base, first - base))
 			return -1;
-		}
 	}
+	while (first < last) {
+		uint32_t bank_end = (first < BANK2_START) ? MIN(last, BANK2_START) : last;
+		if (stm32h7_crc_sectors(t, first, bank_end, &part))
+			return -1;
+		if (ps->crc_mode == H7_CRC_INIT0)
+			part = crc32_combine(0, part, bank_end - first);
+		crc = crc32_combine(crc, part, bank_end - first);
+		first = bank_end;
+	}
+	if (last < end) {
+		if (generic_crc32(t, &part, last, end - last))
+			return -1;
+		crc = crc32_combine(crc, part, end - last);
+	}
+	*crc_res = crc;
 	return 0;
 }
 
@@ -64,6 +64,14 @@
      detecting them.  If we don't then we always must wait for the NVM
      module to complete the last operation before we can start another.
 
+   o Program flash is written and erased by a small RAM stub
+     (flashstub/stm32lx.s).  Half page programming needs the words of
+     each half page written back to back, and page erase needs a wait
+     on BSY between pages; the stub does both without a round trip per
+     operation.  The register driven path is kept and can be selected
+     with "monitor stub disable" to compare the two.  EEPROM (data NVM)
+     is always written through the registers.
+
    o There are minor inconsistencies between the stm32l0 and the
      stm32l1 in when handling NVM operations.
 
@@ -78,6 +86,19 @@
 #include "target_internal.h"
 #include "cortexm.h"
 
+static const uint16_t stm32lx_flash_stub[] = {
+#include "flashstub/stm32lx.stub"
+};
+
+#define SRAM_BASE          0x20000000
+#define STUB_BUFFER_BASE   ALIGN(SRAM_BASE + sizeof(stm32lx_flash_stub), 4)
+/* Largest buffer passed to the stub, fits the 2 KiB SRAM of L0 Cat1 */
+#define STUB_BUFFER_SIZE   0x400
+/* Page erase and half page write take up to about 4 ms each, allow
+   a generous margin on top of a fixed time to start the stub. */
+#define STUB_TIMEOUT_BASE_MS   500
+#define STUB_TIMEOUT_BLOCK_MS  10
+
 #define STM32Lx_NVM_PECR(p)     ((p) + 0x04)
 #define STM32Lx_NVM_PEKEYR(p)   ((p) + 0x0C)
 #define STM32Lx_NVM_PRGKEYR(p)  ((p) + 0x10)
@@ -158,17 +179,31 @@ static int stm32lx_nvm_data_write(struct target_flash* f,
                                   const void* source,
                                   size_t size);
 
+static int stm32lx_nvm_prog_done(struct target_flash *f);
+
 static bool stm32lx_cmd_option     (target* t, int argc, char** argv);
 static bool stm32lx_cmd_eeprom     (target* t, int argc, char** argv);
+static bool stm32lx_cmd_stub       (target* t, int argc, char** argv);
 
 static const struct command_s stm32lx_cmd_list[] = {
         { "option",		(cmd_handler) stm32lx_cmd_option,
           "Manipulate option bytes"},
         { "eeprom",		(cmd_handler) stm32lx_cmd_eeprom,
           "Manipulate EEPROM(NVM data) memory"},
+        { "stub",		(cmd_handler) stm32lx_cmd_stub,
+          "Program flash via RAM stub: (enable|disable)"},
         { NULL, NULL, NULL },
 };
 
+struct stm32lx_flash {
+	struct target_flash f;
+	bool use_stub;
+	/* Statistics reported when a flash session is done */
+	uint32_t erase_ms;
+	uint32_t write_ms;
+	size_t written;
+};
+
 enum {
         STM32L0_DBGMCU_IDCODE_PHYS = 0x40015800,
         STM32L1_DBGMCU_IDCODE_PHYS = 0xe0042000,
@@ -232,18 +267,21 @@ static uint32_t stm32lx_nvm_option_size(target *t)
 static void stm32l_add_flash(target *t,
                              uint32_t addr, size_t length, size_t erasesize)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
+	struct stm32lx_flash *sf = calloc(1, sizeof(*sf));
+	if (!sf) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return;
 	}
 
+	struct target_flash *f = &sf->f;
 	f->start = addr;
 	f->length = length;
 	f->blocksize = erasesize;
 	f->erase = stm32lx_nvm_prog_erase;
 	f->write = stm32lx_nvm_prog_write;
-	f->buf_size = erasesize/2;
+	f->done = stm32lx_nvm_prog_done;
+	f->buf_size = STUB_BUFFER_SIZE;
+	sf->use_stub = true;
 	target_add_flash(t, f);
 }
 
@@ -338,16 +376,61 @@ static bool stm32lx_nvm_opt_unlock(target *t, uint32_t nvm)
                  & STM32Lx_NVM_PECR_OPTLOCK);
 }
 
-/** Erase a region of program flash using operations through the debug
-    interface.  This is slower than stubbed versions(see NOTES).  The
-    flash array is erased for all pages from addr to addr+len
-    inclusive.  NVM register file address chosen from target. */
+/** Wait for the NVM to complete the last operation and check it for
+    errors.  Returns 0 on success. */
+static int stm32lx_nvm_wait(target *t, uint32_t nvm)
+{
+	uint32_t sr;
+	do {
+		sr = target_mem_read32(t, STM32Lx_NVM_SR(nvm));
+	} while ((sr & STM32Lx_NVM_SR_BSY) && !target_check_error(t));
+
+	if ((sr & STM32Lx_NVM_SR_ERR_M) || !(sr & STM32Lx_NVM_SR_EOP) ||
+	    target_check_error(t))
+		return -1;
+
+	return 0;
+}
+
+/** Run the flash stub on blocks of program flash.  For an erase, src
+    is NULL and each block is a page, otherwise each block is a half
+    page already loaded into the stub buffer.  PECR must be set up by
+    the caller.  The timeout scales with the number of blocks, a mass
+    of pages on a 512 KiB part takes far longer than a few. */
+static int stm32lx_nvm_run_stub(target *t, uint32_t nvm, target_addr dest,
+                                bool erase, size_t blocks, size_t block_size)
+{
+	int ret = cortexm_start_stub(t, SRAM_BASE, dest,
+	                             erase ? 0 : STUB_BUFFER_BASE,
+	                             blocks | ((block_size / 4) << 16), nvm);
+	if (!ret)
+		ret = cortexm_wait_stub(t, STUB_TIMEOUT_BASE_MS +
+		                        blocks * STUB_TIMEOUT_BLOCK_MS);
+	if (ret) {
+		DEBUG_WARN("stm32lx flash stub error %d: sr 0x%" PRIx32 "\n",
+		           ret, target_mem_read32(t, STM32Lx_NVM_SR(nvm)));
+		return -1;
+	}
+	return 0;
+}
+
+/** Erase a region of program flash.  The flash array is erased for all
+    pages from addr to addr+len inclusive.  Without the stub this issues
+    the page erases through the debug interface, which is slower (see
+    NOTES).  NVM register file address chosen from target. */
 static int stm32lx_nvm_prog_erase(struct target_flash* f,
                                   target_addr addr, size_t len)
 {
+	struct stm32lx_flash *sf = (struct stm32lx_flash *)f;
 	target *t = f->t;
 	const size_t page_size = f->blocksize;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
+	uint32_t start_time = platform_time_ms();
+	int ret = 0;
+
+	if (sf->use_stub)
+		target_mem_write(t, SRAM_BASE, stm32lx_flash_stub,
+		                 sizeof(stm32lx_flash_stub));
 
 	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
 	        return -1;
@@ -365,42 +448,50 @@ static int stm32lx_nvm_prog_erase(struct target_flash* f,
 	   block to complete the last operation. */
 	target_mem_write32(t, STM32Lx_NVM_SR(nvm), STM32Lx_NVM_SR_ERR_M);
 
-	while (len > 0) {
-		/* Write first word of page to 0 */
-		target_mem_write32(t, addr, 0);
-		if (len > page_size)
-			len  -= page_size;
-		else
-			len = 0;
-		addr += page_size;
+	if (sf->use_stub) {
+		size_t pages = (len + page_size - 1) / page_size;
+		ret = stm32lx_nvm_run_stub(t, nvm, addr, true, pages, page_size);
+	} else {
+		while (len > 0 && !ret) {
+			/* Write first word of page to 0 */
+			target_mem_write32(t, addr, 0);
+			ret = stm32lx_nvm_wait(t, nvm);
+			if (len > page_size)
+				len  -= page_size;
+			else
+				len = 0;
+			addr += page_size;
+		}
 	}
 
 	/* Disable further programming by locking PECR */
 	stm32lx_nvm_lock(t, nvm);
 
-	/* Wait for completion or an error */
-	uint32_t sr;
-	do {
-		sr = target_mem_read32(t, STM32Lx_NVM_SR(nvm));
-	} while (sr & STM32Lx_NVM_SR_BSY);
-
-	if ((sr & STM32Lx_NVM_SR_ERR_M) || !(sr & STM32Lx_NVM_SR_EOP) ||
-	    target_check_error(t))
-			return -1;
-
-	return 0;
+	sf->erase_ms += platform_time_ms() - start_time;
+	return ret;
 }
 
 
-/** Write to program flash using operations through the debug
-    interface. */
+/** Write to program flash, one buffer of whole half pages at a time.
+    Without the stub each half page is written through the debug
+    interface and the NVM polled before the next. */
 static int stm32lx_nvm_prog_write(struct target_flash *f,
                                   target_addr dest,
                                   const void* src,
                                   size_t size)
 {
+	struct stm32lx_flash *sf = (struct stm32lx_flash *)f;
 	target *t = f->t;
+	const size_t half_page = f->blocksize / 2;
 	const uint32_t nvm = stm32lx_nvm_phys(t);
+	uint32_t start_time = platform_time_ms();
+	int ret = 0;
+
+	if (sf->use_stub) {
+		target_mem_write(t, SRAM_BASE, stm32lx_flash_stub,
+		                 sizeof(stm32lx_flash_stub));
+		target_mem_write(t, STUB_BUFFER_BASE, src, size);
+	}
 
 	if (!stm32lx_nvm_prog_data_unlock(t, nvm))
 	        return -1;
@@ -414,21 +505,39 @@ static int stm32lx_nvm_prog_write(struct target_flash *f,
 
 	target_mem_write32(t, STM32Lx_NVM_PECR(nvm),
 	                   STM32Lx_NVM_PECR_PROG | STM32Lx_NVM_PECR_FPRG);
-	target_mem_write(t, dest, src, size);
+
+	if (sf->use_stub) {
+		ret = stm32lx_nvm_run_stub(t, nvm, dest, false,
+		                           size / half_page, half_page);
+	} else {
+		for (size_t i = 0; i < size && !ret; i += half_page) {
+			target_mem_write(t, dest + i, (const uint8_t *)src + i,
+			                 half_page);
+			ret = stm32lx_nvm_wait(t, nvm);
+		}
+	}
 
 	/* Disable further programming by locking PECR */
 	stm32lx_nvm_lock(t, nvm);
 
-	/* Wait for completion or an error */
-	uint32_t sr;
-	do {
-		sr = target_mem_read32(t, STM32Lx_NVM_SR(nvm));
-	} while (sr & STM32Lx_NVM_SR_BSY);
-
-	if ((sr & STM32Lx_NVM_SR_ERR_M) || !(sr & STM32Lx_NVM_SR_EOP) ||
-	    target_check_error(t))
-			return -1;
+	sf->write_ms += platform_time_ms() - start_time;
+	sf->written += size;
+	return ret;
+}
 
+/** Report the time spent in the flash operations of this session. */
+static int stm32lx_nvm_prog_done(struct target_flash *f)
+{
+	struct stm32lx_flash *sf = (struct stm32lx_flash *)f;
+
+	if (sf->erase_ms || sf->written)
+		DEBUG_INFO("STM32Lx flash 0x%08" PRIx32 ": erase %" PRIu32
+		           " ms, write %" PRIu32 " bytes in %" PRIu32 " ms (%s)\n",
+		           f->start, sf->erase_ms, (uint32_t)sf->written,
+		           sf->write_ms, sf->use_stub ? "stub" : "registers");
+	sf->erase_ms = 0;
+	sf->write_ms = 0;
+	sf->written = 0;
 	return 0;
 }
 
@@ -767,3 +876,35 @@ done:
         stm32lx_nvm_lock(t, nvm);
         return true;
 }
+
+
+static bool stm32lx_cmd_stub(target* t, int argc, char** argv)
+{
+        bool use_stub;
+
+        if (argc == 1) {
+                for (struct target_flash *f = t->flash; f; f = f->next) {
+                        if (f->write != stm32lx_nvm_prog_write)
+                                continue;
+                        tc_printf(t, "Flash stub %s\n",
+                                  ((struct stm32lx_flash *)f)->use_stub
+                                  ? "enabled" : "disabled");
+                        return true;
+                }
+                return true;
+        }
+
+        if (!strcasecmp(argv[1], "enable"))
+                use_stub = true;
+        else if (!strcasecmp(argv[1], "disable"))
+                use_stub = false;
+        else {
+                tc_printf(t, "usage: monitor stub (enable|disable)\n");
+                return true;
+        }
+
+        for (struct target_flash *f = t->flash; f; f = f->next)
+                if (f->write == stm32lx_nvm_prog_write)
+                        ((struct stm32lx_flash *)f)->use_stub = use_stub;
+        return true;
+}
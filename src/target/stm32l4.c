@@ -21,7 +21,8 @@
 /* This file implements STM32L4 target specific functions for detecting
  * the device, providing the XML memory map and Flash memory programming.
  *
- * On L4, flash and options are written in DWORDs (8-Byte) only.
+ * On L4, flash and options are written in DWORDs (8-Byte) only. Whole
+ * rows are written in fast programming mode by the flashstub/stm32l4.s stub.
  *
  * References:
  * RM0351 STM32L4x5 and STM32L4x6 advanced ARM®-based 32-bit MCUs Rev. 5
@@ -54,6 +55,14 @@ const struct command_s stm32l4_cmd_list[] = {
 static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int stm32l4_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+static int stm32l4_flash_done(struct target_flash *f);
+
+static const uint16_t stm32l4_flash_fast_stub[] = {
+#include "flashstub/stm32l4.stub"
+};
+
+#define SRAM_BASE			0x20000000
+#define STUB_BUFFER_BASE	ALIGN(SRAM_BASE + sizeof(stm32l4_flash_fast_stub), 4)
 
 /* Flash Program ad Erase Controller Register Map */
 #define L4_FPEC_BASE			0x40022000
@@ -92,6 +101,22 @@ static int stm32l4_flash_write(struct target_flash *f,
 #define FLASH_SR_ERROR_MASK	0xC3FA
 #define FLASH_SR_BSY		(1 << 16)
 
+/* Reset and Clock Control, only used to check HCLK for fast programming */
+#define L4_RCC_BASE			0x40021000
+#define WB_RCC_BASE			0x58000000
+#define RCC_CR				0x00
+#define RCC_CFGR			0x08
+#define RCC_CSR				0x94
+#define RCC_CR_MSIRGSEL		(1 << 3)
+#define RCC_CR_MSIRANGE_SHIFT	4
+#define RCC_CSR_MSISRANGE_SHIFT	8
+#define RCC_MSIRANGE_8MHZ	7
+#define RCC_CFGR_SWS_SHIFT	2
+#define RCC_CFGR_SWS_MSI	0
+#define RCC_CFGR_SWS_HSI16	1
+#define RCC_CFGR_SWS_PLL	3
+#define RCC_CFGR_HPRE_DIV	(1 << 7)
+
 #define FLASH_SIZE_MAX_G4_CAT4  (512U * 1024U)   // 512 kiB
 
 #define KEY1 0x45670123
@@ -124,6 +149,12 @@ enum {
 struct stm32l4_flash {
 	struct target_flash f;
 	uint32_t bank1_start;
+	uint32_t row_size; /* Fast programming row, 0 if not used */
+	/* Fast programming needs a mass erased bank.  Set by a mass erase
+	 * or by an erase of the whole bank, cleared when a flash sequence
+	 * that wrote to the bank is done. */
+	bool mass_erased;
+	bool written;
 };
 
 struct stm32l4_priv_s {
@@ -359,6 +390,27 @@ static void stm32l4_flash_write32(target *t, enum stm32l4_flash_regs reg, uint32
 	target_mem_write32(t, addr, value);
 }
 
+/* FSTPG programs a row of double words with one high voltage cycle.
+ * Rows are 32 double words on the parts with a 64 bit wide array,
+ * 64 double words on WB. L4Rx in single bank and G47x in single bank
+ * mode use a 128 bit wide array and are left on the normal path.
+ */
+static uint32_t stm32l4_fast_row_size(struct stm32l4_info const *chip,
+                                      size_t blocksize)
+{
+	switch (chip->family) {
+	case FAM_STM32L4xx:
+	case FAM_STM32G4xx:
+		return (blocksize == 0x800) ? 256 : 0;
+	case FAM_STM32L4Rx:
+		return (blocksize == 0x1000) ? 256 : 0;
+	case FAM_STM32WBxx:
+		return 512;
+	default:
+		return 0;
+	}
+}
+
 static void stm32l4_add_flash(target *t,
                               uint32_t addr, size_t length, size_t blocksize,
                               uint32_t bank1_start)
@@ -377,9 +429,12 @@ static void stm32l4_add_flash(target *t,
 	f->blocksize = blocksize;
 	f->erase = stm32l4_flash_erase;
 	f->write = stm32l4_flash_write;
+	f->done = stm32l4_flash_done;
 	f->buf_size = 2048;
 	f->erased = 0xff;
 	sf->bank1_start = bank1_start;
+	sf->row_size = stm32l4_fast_row_size(stm32l4_get_chip_info(t->idcode),
+	                                     blocksize);
 	target_add_flash(t, f);
 }
 #define L5_RCC_APB1ENR1        0x50021058
@@ -555,6 +610,7 @@ static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t
 	uint32_t bank1_start = ((struct stm32l4_flash *)f)->bank1_start;
 	uint32_t page;
 	uint32_t blocksize = f->blocksize;
+	bool whole_bank = (addr == f->start) && (len >= f->length);
 
 	stm32l4_flash_unlock(t);
 
@@ -594,6 +650,82 @@ static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t
 	if(sr & FLASH_SR_ERROR_MASK)
 		return -1;
 
+	if (whole_bank)
+		((struct stm32l4_flash *)f)->mass_erased = true;
+	return 0;
+}
+
+/* Fast programming needs HCLK of at least 8 MHz. L4 and WB come out of
+ * reset on the 4 MHz MSI, so only use it when the firmware has already
+ * set up a fast enough clock. HSE frequency is unknown, so skip it too.
+ */
+static bool stm32l4_fast_clock_ok(target *t, struct stm32l4_info const *chip)
+{
+	uint32_t rcc = (chip->family == FAM_STM32WBxx) ? WB_RCC_BASE : L4_RCC_BASE;
+	uint32_t cfgr = target_mem_read32(t, rcc + RCC_CFGR);
+	if (cfgr & RCC_CFGR_HPRE_DIV)
+		return false;
+	switch ((cfgr >> RCC_CFGR_SWS_SHIFT) & 3) {
+	case RCC_CFGR_SWS_MSI: {
+		uint32_t cr = target_mem_read32(t, rcc + RCC_CR);
+		uint32_t range = (cr >> RCC_CR_MSIRANGE_SHIFT) & 0xf;
+		if ((chip->family != FAM_STM32WBxx) && !(cr & RCC_CR_MSIRGSEL))
+			range = (target_mem_read32(t, rcc + RCC_CSR) >>
+			         RCC_CSR_MSISRANGE_SHIFT) & 0xf;
+		return range >= RCC_MSIRANGE_8MHZ;
+	}
+	case RCC_CFGR_SWS_HSI16:
+	case RCC_CFGR_SWS_PLL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Returns the number of bytes programmed before a row failed */
+static size_t stm32l4_flash_write_fast(struct target_flash *f,
+                                       target_addr dest, const void *src,
+                                       size_t len)
+{
+	target *t = f->t;
+	struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+	struct stm32l4_info const *chip = stm32l4_get_chip_info(t->idcode);
+
+	/* A stale error flag keeps FSTPG from starting */
+	stm32l4_flash_write32(t, FLASH_SR, stm32l4_flash_read32(t, FLASH_SR));
+	target_mem_write(t, SRAM_BASE, stm32l4_flash_fast_stub,
+	                 sizeof(stm32l4_flash_fast_stub));
+	target_mem_write(t, STUB_BUFFER_BASE, src, len);
+	if (target_check_error(t))
+		return 0;
+
+	uint32_t rows = ((sf->row_size / 4) << 16) | (len / sf->row_size);
+	int ret = cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, rows,
+	                           chip->flash_regs_map[FLASH_SR]);
+	if (!ret)
+		return len;
+
+	uint32_t sr = stm32l4_flash_read32(t, FLASH_SR);
+	DEBUG_WARN("stm32l4 fast flash write error %d: sr 0x%" PRIx32 "\n",
+	           ret, sr);
+	stm32l4_flash_write32(t, FLASH_SR, sr);
+	size_t done = 0;
+	if (ret == 1) {
+		/* R0 is past the failed row, the rows before it are good */
+		uint32_t regs[t->regs_size / sizeof(uint32_t)];
+		target_regs_read(t, regs);
+		if ((regs[0] >= dest + sf->row_size) && (regs[0] <= dest + len))
+			done = regs[0] - dest - sf->row_size;
+	}
+	return done;
+}
+
+static int stm32l4_flash_done(struct target_flash *f)
+{
+	struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+	if (sf->written)
+		sf->mass_erased = false;
+	sf->written = false;
 	return 0;
 }
 
@@ -601,6 +733,21 @@ static int stm32l4_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len)
 {
 	target *t = f->t;
+	struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+	sf->written = true;
+	if (sf->mass_erased && sf->row_size &&
+	    !(dest % sf->row_size) && !(len % sf->row_size) &&
+	    stm32l4_fast_clock_ok(t, stm32l4_get_chip_info(t->idcode))) {
+		size_t done = stm32l4_flash_write_fast(f, dest, src, len);
+		if (done == len)
+			return 0;
+		/* Program the rest the standard way */
+		sf->mass_erased = false;
+		dest += done;
+		src = (const uint8_t *)src + done;
+		len -= done;
+	}
+
 	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_PG);
 	target_mem_write(t, dest, src, len);
 	/* Wait for completion or an error */
@@ -639,6 +786,16 @@ static bool stm32l4_cmd_erase(target *t, uint32_t action)
 	uint16_t sr = stm32l4_flash_read32(t, FLASH_SR);
 	if (sr & FLASH_SR_ERROR_MASK)
 		return false;
+
+	/* Allow fast programming on the banks erased */
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write != stm32l4_flash_write)
+			continue;
+		struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+		bool bank2 = f->start >= sf->bank1_start;
+		if (bank2 ? (action & FLASH_CR_MER2) : (action & FLASH_CR_MER1))
+			sf->mass_erased = true;
+	}
 	return true;
 }
 
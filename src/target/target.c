@@ -27,7 +27,6 @@ target *target_list = NULL;
 
 static int target_flash_write_buffered(struct target_flash *f,
                                        target_addr dest, const void *src, size_t len);
-static int target_flash_done_buffered(struct target_flash *f);
 
 static bool nop_function(void)
 {
@@ -116,6 +115,7 @@ void target_list_free(void)
 			target_list->commands = tc;
 		}
 		free(target_list->target_storage);
+		free(target_list->regs_cache);
 		target_mem_map_free(target_list);
 		while (target_list->bw_list) {
 			void * next = target_list->bw_list->next;
@@ -168,9 +168,52 @@ target *target_attach(target *t, struct target_controller *tc)
 		return NULL;
 
 	t->attached = true;
+	t->regs_cached = false;
+
+	/* Further cores of the same device are attached as threads */
+	for (target *thr = t->next_thread; thr; thr = thr->next_thread) {
+		if (thr->tc)
+			thr->tc->destroy_callback(thr->tc, thr);
+		thr->tc = tc;
+		thr->attached = thr->attach(thr);
+		thr->regs_cached = false;
+		if (!thr->attached)
+			DEBUG_WARN("Attach to %s %s failed\n", thr->driver,
+			           thr->core ? thr->core : "");
+	}
 	return t;
 }
 
+/* Make thread a further core of t, to be attached along with t and
+ * shown to GDB as a thread of the same inferior. */
+void target_add_thread(target *t, target *thread)
+{
+	while (t->next_thread)
+		t = t->next_thread;
+	t->next_thread = thread;
+}
+
+/* Number of attached threads of t, at least 1 for t itself. */
+int target_thread_count(target *t)
+{
+	int n = 1;
+	for (target *thr = t->next_thread; thr; thr = thr->next_thread)
+		if (thr->attached)
+			n++;
+	return n;
+}
+
+/* Thread n of t, counting from 1 for t itself, or NULL. */
+target *target_thread(target *t, int n)
+{
+	if (n == 1)
+		return t;
+	for (target *thr = t->next_thread; thr; thr = thr->next_thread)
+		if (thr->attached && (--n == 1))
+			return thr;
+	return NULL;
+}
+
 void target_add_ram(target *t, target_addr start, uint32_t len)
 {
 	struct target_ram *ram = malloc(sizeof(*ram));
@@ -344,6 +387,11 @@ int target_flash_done_buffered(struct target_flash *f)
 /* Wrapper functions */
 void target_detach(target *t)
 {
+	for (target *thr = t->next_thread; thr; thr = thr->next_thread) {
+		if (thr->attached)
+			thr->detach(thr);
+		thr->attached = false;
+	}
 	t->detach(t);
 	t->attached = false;
 #if PC_HOSTED == 1
@@ -373,6 +421,14 @@ int target_mem_write(target *t, target_addr dest, const void *src, size_t len)
 	return target_check_error(t);
 }
 
+/* Returns > 0 if the target can not compute this CRC itself */
+int target_crc32(target *t, uint32_t *crc, target_addr base, size_t len)
+{
+	if (!t->crc32)
+		return 1;
+	return t->crc32(t, crc, base, len);
+}
+
 /* Register access functions */
 ssize_t target_reg_read(target *t, int reg, void *data, size_t max)
 {
@@ -381,21 +437,35 @@ ssize_t target_reg_read(target *t, int reg, void *data, size_t max)
 
 ssize_t target_reg_write(target *t, int reg, const void *data, size_t size)
 {
+	t->regs_cached = false;
 	return t->reg_write(t, reg, data, size);
 }
 
+/* The register file is cached while the target stays halted, so that
+ * switching between GDB threads does not read all registers again. */
 void target_regs_read(target *t, void *data)
 {
+	if (t->regs_cached) {
+		memcpy(data, t->regs_cache, t->regs_size);
+		return;
+	}
 	if (t->regs_read) {
 		t->regs_read(t, data);
-		return;
+	} else {
+		for (size_t x = 0, i = 0; x < t->regs_size; ) {
+			x += t->reg_read(t, i++, data + x, t->regs_size - x);
+		}
 	}
-	for (size_t x = 0, i = 0; x < t->regs_size; ) {
-		x += t->reg_read(t, i++, data + x, t->regs_size - x);
+	if (!t->regs_cache)
+		t->regs_cache = malloc(t->regs_size);
+	if (t->regs_cache && !target_check_error(t)) {
+		memcpy(t->regs_cache, data, t->regs_size);
+		t->regs_cached = true;
 	}
 }
 void target_regs_write(target *t, const void *data)
 {
+	t->regs_cached = false;
 	if (t->regs_write) {
 		t->regs_write(t, data);
 		return;
@@ -406,14 +476,42 @@ void target_regs_write(target *t, const void *data)
 }
 
 /* Halt/resume functions */
-void target_reset(target *t) { t->reset(t); }
+void target_reset(target *t)
+{
+	t->regs_cached = false;
+	t->reset(t);
+}
+
 void target_halt_request(target *t) { t->halt_request(t); }
 enum target_halt_reason target_halt_poll(target *t, target_addr *watch)
 {
-	return t->halt_poll(t, watch);
+	enum target_halt_reason reason = t->halt_poll(t, watch);
+	/* Registers may have been read while running, start afresh */
+	if (reason != TARGET_HALT_RUNNING)
+		t->regs_cached = false;
+	return reason;
+}
+
+void target_halt_resume(target *t, bool step)
+{
+	t->regs_cached = false;
+	t->halt_resume(t, step);
 }
 
-void target_halt_resume(target *t, bool step) { t->halt_resume(t, step); }
+/* Resume threads of t, actions[n] is 's' to step thread n, 'c' to
+ * continue it and 0 to leave it halted. */
+void target_threads_resume(target *t, const char *actions)
+{
+	int n = target_thread_count(t);
+	t->threads_resuming = true;
+	for (int i = 1; i <= n; i++) {
+		if (actions[i])
+			target_halt_resume(target_thread(t, i), actions[i] == 's');
+	}
+	t->threads_resuming = false;
+	if (t->threads_restart)
+		t->threads_restart(t);
+}
 
 /* Command line for semihosting get_cmdline */
 void target_set_cmdline(target *t, char *cmdline) {
@@ -88,6 +88,9 @@ struct target_s {
 	                 size_t len);
 	void (*mem_write)(target *t, target_addr dest,
 	                  const void *src, size_t len);
+	/* Optional target side CRC32 as used by qCRC. Returns > 0 if the
+	 * range is not supported and generic_crc32() must be used. */
+	int (*crc32)(target *t, uint32_t *crc, target_addr base, size_t len);
 
 	/* Register access functions */
 	size_t regs_size;
@@ -96,6 +99,9 @@ struct target_s {
 	void (*regs_write)(target *t, const void *data);
 	ssize_t (*reg_read)(target *t, int reg, void *data, size_t max);
 	ssize_t (*reg_write)(target *t, int reg, const void *data, size_t size);
+	/* Register file cache, valid while the target stays halted */
+	void *regs_cache;
+	bool regs_cached;
 
 	/* Halt/resume functions */
 	void (*reset)(target *t);
@@ -103,6 +109,11 @@ struct target_s {
 	void (*halt_request)(target *t);
 	enum target_halt_reason (*halt_poll)(target *t, target_addr *watch);
 	void (*halt_resume)(target *t, bool step);
+	/* Restart the threads continued by target_threads_resume() at the
+	 * same time. halt_resume of a thread may leave the restart to this
+	 * while threads_resuming of the first thread is set. */
+	void (*threads_restart)(target *t);
+	bool threads_resuming;
 
 	/* Break-/watchpoint functions */
 	int (*breakwatch_set)(target *t, struct breakwatch*);
@@ -131,6 +142,8 @@ struct target_s {
 	struct target_command_s *commands;
 
 	struct target_s *next;
+	/* Further cores attached with this one and shown as GDB threads */
+	struct target_s *next_thread;
 
 	void *priv;
 	void (*priv_free)(void *);
@@ -140,6 +153,8 @@ void target_mem_map_free(target *t);
 void target_add_commands(target *t, const struct command_s *cmds, const char *name);
 void target_add_ram(target *t, target_addr start, uint32_t len);
 void target_add_flash(target *t, struct target_flash *f);
+int target_flash_done_buffered(struct target_flash *f);
+void target_add_thread(target *t, target *thread);
 
 /* Convenience function for MMIO access */
 uint32_t target_mem_read32(target *t, uint32_t addr);
@@ -0,0 +1,173 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Bit exactness checks for the JTAG TAP sequence routines.  Every
+ * rising TCK edge must carry TMS low except for the last one, which
+ * carries final_tms, and TDI must carry the DI bits LSB first.  DO
+ * receives the TDO bit of each edge.
+ */
+#include "general.h"
+#include "jtagtap.h"
+#include "wire.h"
+
+#define MAX_TICKS 200
+#define ROUNDS 2000
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static void check_edges(const char *fn, int ticks, uint8_t final_tms,
+						const uint8_t *DI)
+{
+	if (wire_n_edges != ticks) {
+		wire_fail("%s: %d ticks gave %d edges\n", fn, ticks, wire_n_edges);
+		return;
+	}
+	for (int i = 0; i < ticks; i++) {
+		uint8_t tms = (i == ticks - 1) ? final_tms : 0;
+		uint8_t tdi = (DI[i / 8] >> (i % 8)) & 1;
+		if (wire_edges[i].tms != tms || wire_edges[i].tdi != tdi) {
+			wire_fail("%s: %d ticks, edge %d: TMS %d TDI %d, "
+					  "expected %d %d\n", fn, ticks, i,
+					  wire_edges[i].tms, wire_edges[i].tdi, tms, tdi);
+			return;
+		}
+	}
+}
+
+static void check_tdi_tdo_seq(int ticks, uint8_t final_tms, bool keep_tail)
+{
+	uint8_t DI[MAX_TICKS / 8 + 2], DO[MAX_TICKS / 8 + 2];
+	uint8_t old[sizeof(DO)];
+	int bytes = (ticks + 7) / 8;
+
+	for (size_t i = 0; i < sizeof(DI); i++) {
+		DI[i] = rnd();
+		DO[i] = old[i] = rnd();
+	}
+	wire_reset(rnd());
+	jtag_proc.jtagtap_tdi_tdo_seq(DO, final_tms, DI, ticks);
+	check_edges("tdi_tdo_seq", ticks, final_tms, DI);
+	for (int i = 0; i < ticks; i++) {
+		if (((DO[i / 8] >> (i % 8)) & 1) != wire_input(i)) {
+			wire_fail("tdi_tdo_seq: %d ticks, DO bit %d wrong\n", ticks, i);
+			return;
+		}
+	}
+	if (keep_tail && (ticks % 8)) {
+		uint8_t mask = 0xff << (ticks % 8);
+		if ((DO[bytes - 1] & mask) != (old[bytes - 1] & mask))
+			wire_fail("tdi_tdo_seq: %d ticks, tail of DO changed\n", ticks);
+	}
+	for (size_t i = bytes; i < sizeof(DO); i++) {
+		if (DO[i] != old[i])
+			wire_fail("tdi_tdo_seq: %d ticks, DO[%zu] changed\n", ticks, i);
+	}
+
+	/* DO may point to DI */
+	uint8_t expect[sizeof(DI)];
+	memcpy(expect, DI, sizeof(DI));
+	wire_reset(rnd());
+	jtag_proc.jtagtap_tdi_tdo_seq(DI, final_tms, DI, ticks);
+	check_edges("tdi_tdo_seq in place", ticks, final_tms, expect);
+	for (int i = 0; i < ticks; i++) {
+		if (((DI[i / 8] >> (i % 8)) & 1) != wire_input(i)) {
+			wire_fail("tdi_tdo_seq in place: %d ticks, DO bit %d wrong\n",
+					  ticks, i);
+			return;
+		}
+	}
+}
+
+static void check_tdi_seq(int ticks, uint8_t final_tms)
+{
+	uint8_t DI[MAX_TICKS / 8 + 1];
+
+	for (size_t i = 0; i < sizeof(DI); i++)
+		DI[i] = rnd();
+	wire_reset(rnd());
+	jtag_proc.jtagtap_tdi_seq(final_tms, DI, ticks);
+	check_edges("tdi_seq", ticks, final_tms, DI);
+}
+
+static void check_tms_seq(int ticks)
+{
+	uint32_t MS = rnd();
+
+	wire_reset(rnd());
+	jtag_proc.jtagtap_tms_seq(MS, ticks);
+	if (wire_n_edges != ticks) {
+		wire_fail("tms_seq: %d ticks gave %d edges\n", ticks, wire_n_edges);
+		return;
+	}
+	for (int i = 0; i < ticks; i++) {
+		if (wire_edges[i].tms != ((MS >> i) & 1) || !wire_edges[i].tdi) {
+			wire_fail("tms_seq: %d ticks, edge %d wrong\n", ticks, i);
+			return;
+		}
+	}
+}
+
+static void check_next(void)
+{
+	for (int i = 0; i < 4; i++) {
+		wire_reset(rnd());
+		uint8_t ret = jtag_proc.jtagtap_next(i & 1, i >> 1);
+		if (wire_n_edges != 1 || wire_edges[0].tms != (i & 1) ||
+			wire_edges[0].tdi != (i >> 1) || ret != wire_input(0))
+			wire_fail("next(%d, %d) wrong\n", i & 1, i >> 1);
+	}
+}
+
+int jtag_check(bool keep_tail)
+{
+	extern uint32_t swd_delay_cnt;
+	static const uint32_t delays[] = {0, 1, 4};
+
+	for (size_t d = 0; d < sizeof(delays) / sizeof(delays[0]); d++) {
+		swd_delay_cnt = delays[d];
+		check_next();
+		for (int ticks = 1; ticks <= 32; ticks++)
+			check_tms_seq(ticks);
+		for (int ticks = 1; ticks <= MAX_TICKS; ticks++) {
+			check_tdi_tdo_seq(ticks, 0, keep_tail);
+			check_tdi_tdo_seq(ticks, 1, keep_tail);
+			check_tdi_seq(ticks, 0);
+			check_tdi_seq(ticks, 1);
+		}
+		for (int i = 0; i < ROUNDS; i++) {
+			int ticks = 1 + rnd() % MAX_TICKS;
+			check_tdi_tdo_seq(ticks, rnd() & 1, keep_tail);
+			check_tdi_seq(ticks, rnd() & 1);
+		}
+	}
+	/* Zero length sequences must not touch the wire */
+	uint8_t buf[1] = {0x5a};
+	wire_reset(0);
+	jtag_proc.jtagtap_tdi_tdo_seq(buf, 1, buf, 0);
+	jtag_proc.jtagtap_tdi_seq(1, buf, 0);
+	if (wire_n_edges || buf[0] != 0x5a)
+		wire_fail("zero length sequence clocked the TAP\n");
+	return wire_errors;
+}
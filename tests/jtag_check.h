@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __JTAG_CHECK_H
+#define __JTAG_CHECK_H
+
+#include <stdbool.h>
+
+/* Check the routines in jtag_proc against the bit sequences they must
+ * put on the wire.  keep_tail tells whether jtagtap_tdi_tdo_seq leaves
+ * the bits of the last DO byte beyond the sequence alone.  Returns the
+ * number of failures.
+ */
+int jtag_check(bool keep_tail);
+
+#endif
@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs the bit-banged firmware jtagtap routines on the mock GPIOs. */
+#include "../src/platforms/common/jtagtap.c"
+#include "jtag_check.h"
+#include "wire.h"
+
+int main(void)
+{
+	jtagtap_init();
+
+	int errors = jtag_check(false);
+	printf("jtagtap_common: %s\n", errors ? "FAIL" : "ok");
+	return errors != 0;
+}
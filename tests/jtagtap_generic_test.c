@@ -0,0 +1,46 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs the generic jtagtap routines on top of a mock jtagtap_next. */
+#include <stdint.h>
+
+uint8_t jtagtap_next(uint8_t dTMS, uint8_t dTDI);
+
+#include "../src/target/jtagtap_generic.c"
+#include "jtag_check.h"
+#include "wire.h"
+
+jtag_proc_t jtag_proc;
+
+uint8_t jtagtap_next(uint8_t dTMS, uint8_t dTDI)
+{
+	uint8_t ret = wire_input(wire_n_edges);
+	wire_clock(dTMS, dTDI);
+	return ret;
+}
+
+int main(void)
+{
+	jtag_proc.jtagtap_next = jtagtap_next;
+	jtag_proc.jtagtap_tms_seq = jtagtap_tms_seq;
+	jtag_proc.jtagtap_tdi_tdo_seq = jtagtap_tdi_tdo_seq;
+	jtag_proc.jtagtap_tdi_seq = jtagtap_tdi_seq;
+
+	int errors = jtag_check(true);
+	printf("jtagtap_generic: %s\n", errors ? "FAIL" : "ok");
+	return errors != 0;
+}
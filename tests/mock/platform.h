@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Stand-in for a firmware platform.h.  The GPIO calls are routed to the
+ * wire model in wire.c, which records the pin levels at every rising
+ * clock edge.  As on the native probe, TMS shares a pin with SWDIO and
+ * TCK with SWCLK.
+ */
+#ifndef __PLATFORM_H
+#define __PLATFORM_H
+
+#include <stdint.h>
+
+#define JTAG_PORT	0
+#define TDI_PORT	JTAG_PORT
+#define TMS_PORT	JTAG_PORT
+#define TCK_PORT	JTAG_PORT
+#define TDO_PORT	JTAG_PORT
+#define TDI_PIN		(1 << 0)
+#define TMS_PIN		(1 << 1)
+#define TCK_PIN		(1 << 2)
+#define TDO_PIN		(1 << 3)
+
+#define SWDIO_PORT	JTAG_PORT
+#define SWCLK_PORT	JTAG_PORT
+#define SWDIO_PIN	TMS_PIN
+#define SWCLK_PIN	TCK_PIN
+
+void gpio_set(uint32_t port, uint16_t pins);
+void gpio_clear(uint32_t port, uint16_t pins);
+uint16_t gpio_get(uint32_t port, uint16_t pins);
+void wire_swdio_drive(int drive);
+
+static inline void gpio_set_val(uint32_t port, uint16_t pin, uint8_t val)
+{
+	if (val)
+		gpio_set(port, pin);
+	else
+		gpio_clear(port, pin);
+}
+
+#define TMS_SET_MODE()		wire_swdio_drive(1)
+#define SWDIO_MODE_FLOAT()	wire_swdio_drive(0)
+#define SWDIO_MODE_DRIVE()	wire_swdio_drive(1)
+
+extern uint32_t swd_delay_cnt;
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Wire model behind the mock GPIOs.  The target changes TDO/SWDIO after
+ * every falling clock edge, so a read always returns the bit belonging
+ * to the next rising edge (SWD) or to the edge just taken (JTAG).
+ */
+#include <stdio.h>
+
+#include "platform.h"
+#include "wire.h"
+
+uint32_t swd_delay_cnt;
+
+struct wire_edge wire_edges[WIRE_MAX_EDGES];
+int wire_n_edges;
+int wire_errors;
+
+static uint16_t levels;
+static bool swdio_driven = true;
+static int falling_edges;
+static uint32_t wire_seed;
+
+void wire_reset(uint32_t seed)
+{
+	wire_n_edges = 0;
+	falling_edges = 0;
+	wire_seed = seed;
+}
+
+uint8_t wire_input(int edge)
+{
+	uint32_t x = wire_seed ^ ((uint32_t)edge * 0x9e3779b9);
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	return x & 1;
+}
+
+void wire_clock(uint8_t tms, uint8_t tdi)
+{
+	if (wire_n_edges >= WIRE_MAX_EDGES) {
+		wire_fail("too many clock edges\n");
+		return;
+	}
+	struct wire_edge *e = &wire_edges[wire_n_edges++];
+	e->tms = tms;
+	e->tdi = tdi;
+	e->driven = swdio_driven;
+}
+
+void wire_swdio_drive(int drive)
+{
+	swdio_driven = drive;
+}
+
+void gpio_set(uint32_t port, uint16_t pins)
+{
+	(void)port;
+	if ((pins & TCK_PIN) && (levels & TCK_PIN))
+		wire_fail("clock set while already high\n");
+	levels |= pins;
+	if (pins & TCK_PIN)
+		wire_clock(!!(levels & TMS_PIN), !!(levels & TDI_PIN));
+}
+
+void gpio_clear(uint32_t port, uint16_t pins)
+{
+	(void)port;
+	if (pins & TCK_PIN) {
+		if (!(levels & TCK_PIN))
+			wire_fail("clock cleared while already low\n");
+		falling_edges++;
+	}
+	levels &= ~pins;
+}
+
+uint16_t gpio_get(uint32_t port, uint16_t pins)
+{
+	(void)port;
+	if ((pins & SWDIO_PIN) && swdio_driven)
+		wire_fail("SWDIO read while driven by the probe\n");
+	return wire_input(falling_edges) ? pins : 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WIRE_H
+#define __WIRE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Pin levels seen by the target at one rising clock edge */
+struct wire_edge {
+	uint8_t tms;		/* TMS, or SWDIO as driven by the probe */
+	uint8_t tdi;
+	bool driven;		/* SWDIO driven by the probe */
+};
+
+#define WIRE_MAX_EDGES 4096
+
+extern struct wire_edge wire_edges[WIRE_MAX_EDGES];
+extern int wire_n_edges;
+extern int wire_errors;
+
+/* Forget all recorded edges and pick a new target data pattern */
+void wire_reset(uint32_t seed);
+/* Record one rising edge, for mocks that don't go through the GPIOs */
+void wire_clock(uint8_t tms, uint8_t tdi);
+/* Bit the target presents on TDO/SWDIO for the given edge */
+uint8_t wire_input(int edge);
+
+#define wire_fail(...) do {						\
+	fprintf(stderr, __VA_ARGS__);					\
+	wire_errors++;							\
+} while (0)
+
+#endif
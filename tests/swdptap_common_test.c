@@ -0,0 +1,188 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs the bit-banged firmware swdptap routines on the mock GPIOs.
+ * Every SWCLK rising edge must carry the expected SWDIO level while the
+ * probe drives, and must leave SWDIO floating while the target drives.
+ * A change of direction costs exactly one turnaround clock.
+ */
+#include "../src/platforms/common/swdptap.c"
+#include "wire.h"
+
+#define ROUNDS 200000
+
+static ADIv5_DP_t dp;
+static bool probe_drives;
+static int edge;
+
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static bool expect_float(const char *fn)
+{
+	if (edge >= wire_n_edges || wire_edges[edge].driven) {
+		wire_fail("%s: edge %d not floating\n", fn, edge);
+		return false;
+	}
+	edge++;
+	return true;
+}
+
+static bool expect_out(const char *fn, uint8_t bit)
+{
+	if (edge >= wire_n_edges || !wire_edges[edge].driven ||
+		wire_edges[edge].tms != bit) {
+		wire_fail("%s: edge %d not driven to %d\n", fn, edge, bit);
+		return false;
+	}
+	edge++;
+	return true;
+}
+
+static bool turnaround(const char *fn, bool drive)
+{
+	if (probe_drives == drive)
+		return true;
+	probe_drives = drive;
+	return expect_float(fn);
+}
+
+static bool done(const char *fn)
+{
+	if (edge != wire_n_edges) {
+		wire_fail("%s: %d extra edges\n", fn, wire_n_edges - edge);
+		return false;
+	}
+	return true;
+}
+
+static void check_seq_out(int ticks)
+{
+	uint32_t MS = rnd();
+
+	wire_reset(rnd());
+	edge = 0;
+	dp.seq_out(MS, ticks);
+	if (!turnaround("seq_out", true))
+		return;
+	for (int i = 0; i < ticks; i++)
+		if (!expect_out("seq_out", (MS >> i) & 1))
+			return;
+	done("seq_out");
+}
+
+static void check_seq_out_parity(int ticks)
+{
+	uint32_t MS = rnd();
+	if (ticks < 32)
+		MS &= (1U << ticks) - 1;
+
+	wire_reset(rnd());
+	edge = 0;
+	dp.seq_out_parity(MS, ticks);
+	if (!turnaround("seq_out_parity", true))
+		return;
+	for (int i = 0; i < ticks; i++)
+		if (!expect_out("seq_out_parity", (MS >> i) & 1))
+			return;
+	if (!expect_out("seq_out_parity", __builtin_parity(MS)))
+		return;
+	done("seq_out_parity");
+}
+
+static void check_seq_in(int ticks)
+{
+	wire_reset(rnd());
+	edge = 0;
+	uint32_t ret = dp.seq_in(ticks);
+	if (!turnaround("seq_in", false))
+		return;
+	uint32_t expect = 0;
+	for (int i = 0; i < ticks; i++) {
+		expect |= (uint32_t)wire_input(edge) << i;
+		if (!expect_float("seq_in"))
+			return;
+	}
+	if (!done("seq_in"))
+		return;
+	if (ret != expect)
+		wire_fail("seq_in: %d ticks read %08x, expected %08x\n",
+				  ticks, ret, expect);
+}
+
+static void check_seq_in_parity(int ticks)
+{
+	wire_reset(rnd());
+	edge = 0;
+	uint32_t ret;
+	bool perr = dp.seq_in_parity(&ret, ticks);
+	if (!turnaround("seq_in_parity", false))
+		return;
+	uint32_t expect = 0;
+	for (int i = 0; i < ticks; i++) {
+		expect |= (uint32_t)wire_input(edge) << i;
+		if (!expect_float("seq_in_parity"))
+			return;
+	}
+	bool expect_perr = __builtin_parity(expect) ^ wire_input(edge);
+	if (!expect_float("seq_in_parity"))
+		return;
+	/* The read cycle ends with the turnaround back to the probe */
+	if (!turnaround("seq_in_parity", true) || !done("seq_in_parity"))
+		return;
+	if (ret != expect || perr != expect_perr)
+		wire_fail("seq_in_parity: %d ticks read %08x/%d, "
+				  "expected %08x/%d\n", ticks, ret, perr, expect, expect_perr);
+}
+
+int main(void)
+{
+	static const uint32_t delays[] = {0, 1, 4};
+
+	/* swdptap starts out assuming the target drives SWDIO */
+	SWDIO_MODE_FLOAT();
+	swdptap_init(&dp);
+	for (size_t d = 0; d < sizeof(delays) / sizeof(delays[0]); d++) {
+		swd_delay_cnt = delays[d];
+		for (int i = 0; i < ROUNDS && !wire_errors; i++) {
+			int ticks = 1 + rnd() % 32;
+			switch (rnd() % 4) {
+			case 0:
+				check_seq_out(ticks);
+				break;
+			case 1:
+				check_seq_out_parity(ticks);
+				break;
+			case 2:
+				check_seq_in(ticks);
+				break;
+			case 3:
+				check_seq_in_parity(ticks);
+				break;
+			}
+		}
+	}
+	printf("swdptap_common: %s\n", wire_errors ? "FAIL" : "ok");
+	return wire_errors != 0;
+}